@@ -1,5 +1,9 @@
 #include "AppConfig.hpp"
 #include "CommandLine.hpp"
+#include "ArrayView.hpp"
+#include <cstring>
+#include <cctype>
+#include <cstdlib>
 
 namespace {
 
@@ -10,25 +14,94 @@ const int DEFAULT_SOFT_SHADOW_RAYS = 10;
 const int DEFAULT_OCCLUSION_RAYS = 32;
 const int DEFAULT_OCCLUSION_STRENGTH = 16;
 const int DEFAULT_THREAD_COUNT = 4;
+const int DEFAULT_FRAME_RATE = 30;
+const int MAX_TGA_SIZE = 65535; // Width and height are stored as 16 bit
 
+struct
+{
+    const char* name;
+    const char* extension;
+    AppConfig::ImageFormat format;
+} IMAGE_FORMAT_DATA[] = {
+    { "tga",    ".tga",     AppConfig::IMAGE_TGA,   },
+    { "qoi",    ".qoi",     AppConfig::IMAGE_QOI,   },
+    { "y4m",    ".y4m",     AppConfig::IMAGE_Y4M,   },
+    { "bgra",   ".bgra",    AppConfig::IMAGE_BGRA,  },
+};
+
+struct
+{
+    const char* name;
+    AppConfig::Projection projection;
+} PROJECTION_DATA[] = {
+    { "perspective",    AppConfig::PROJECTION_PERSPECTIVE,  },
+    { "cubemap",        AppConfig::PROJECTION_CUBEMAP,      },
+    { "equirect",       AppConfig::PROJECTION_EQUIRECT,     },
+};
+
+bool endsWith(const std::string& text, const char* suffix)
+{
+    const size_t length = std::strlen(suffix);
+    if (text.size() < length) { return false; }
+    for (size_t ii = 0; ii < length; ++ii)
+    {
+        if (std::tolower(static_cast<unsigned char>(text[text.size() - length + ii])) != suffix[ii]) { return false; }
+    }
+    return true;
+}
+
+// Reads "all" or a comma separated list of camera indices
+bool parseCameras(const std::string& text, std::vector<int>* indices, bool* all)
+{
+    *all = text == "all";
+    if (*all) { return true; }
+
+    const char* next = text.c_str();
+    do
+    {
+        char* end;
+        const long index = std::strtol(next, &end, 10);
+        if (end == next || index < 0 || (*end != ',' && *end != '\0')) { return false; }
+        indices->push_back(static_cast<int>(index));
+        next = *end ? end + 1 : end;
+    } while (*next);
+    return !indices->empty();
 }
 
+}
+
+const char* const AppConfig::STANDARD_OUTPUT = "-";
+const char* const AppConfig::CAMERA_PLACEHOLDER = "%d";
+const char* const AppConfig::PATH_CORNER_FLYTHROUGH = "path_corner";
+
 AppConfig::ParseResult AppConfig::parse(int argc, char const * const * const argv)
 {
     util::CommandLine cmd;
-    auto mapArg = cmd.add<std::string>("input", 'i', "Path to a compiled Quake 1 level file");
-    auto imageArg = cmd.add<std::string>("output", 'o', "Path to the TGA file that will be written");
+    auto mapArg = cmd.add<std::string>("input", 'i', "Path to a compiled Quake 1 level file, or to a level inside a PAK archive as archive.pak:maps/level.bsp");
+    auto imageArg = cmd.add<std::string>("output", 'o', "Path to the image file that will be written, - writes to standard output");
+    auto formatArg = cmd.add<std::string>("format", "", "Output format: tga, qoi, y4m or bgra (raw frames). Follows the output file extension when omitted, y4m for standard output and tga for anything else");
     auto widthArg = cmd.add<int>("width", 'w', DEFAULT_SCREEN_WIDTH, "Width of the generated image");
     auto heightArg = cmd.add<int>("height", 'h', DEFAULT_SCREEN_HEIGHT, "Height of the generated image");
+    auto stripArg = cmd.add<int>("strip", 0, "Render the image in strips of this many rows, each strip is written out and dropped before the next one so memory use no longer grows with the image size. Needs qoi or bgra output");
+    auto projectionArg = cmd.add<std::string>("projection", std::string("perspective"), "Projection of the image: perspective, cubemap or equirect. A cube map holds six square faces side by side (front, right, back, left, up, down) and needs a width of six times the height, equirect wraps a 360 degree panorama around the camera and looks best at twice the height. Both panoramas are traced in one go and keep the horizon level");
     auto detailArg = cmd.add<int>("detail", 'd', DEFAULT_DETAIL_LEVEL, "Supersampling factor to apply. A value of 2 results in 4 samples per pixel, 3 results in 9 samples, 4 in 16 samples etc.");
     auto occlusionArg = cmd.add<int>("occlusion", DEFAULT_OCCLUSION_RAYS, "Number of rays to cast for ambient occlusion detection");
     auto occlusionStrengthArg = cmd.add<int>("occlusion-strength", DEFAULT_OCCLUSION_STRENGTH, "Occlusion ray length, a higher value will grow ambient occlusion shadows");
     auto shadowsArg = cmd.add<int>("shadows", DEFAULT_SOFT_SHADOW_RAYS, "Number of soft shadow rays");
     auto ambientLightArg = cmd.add<float>("ambient", 0.0f, "Ambient lighting level");
     auto threadsArg = cmd.add<int>("threads", 'j', DEFAULT_THREAD_COUNT, "Number of worker threads to use while raytracing, best set to the number of CPU cores");
-    auto cameraArg = cmd.add<int>("camera", 'c', 0, "Intermission camera index to use as viewpoint");
+    auto cameraArg = cmd.add<std::string>("camera", 'c', std::string("0"), "Intermission camera index to use as viewpoint, a comma separated list of indices or all. Several cameras are rendered with one scene load, into files named by a %d in the output path or as frames of one y4m or bgra stream");
+    auto flythroughArg = cmd.add<std::string>("flythrough", "", "Render a flythrough instead of still cameras, from a keyframe file with one 'time x y z pitch yaw' per line or from the path_corner entities of the level when set to path_corner. Frames are numbered like cameras");
+    auto frameRateArg = cmd.add<int>("fps", DEFAULT_FRAME_RATE, "Frames per second of a flythrough and of y4m output");
+    auto animateArg = cmd.add<std::string>("animate", "", "Move brush models over time, from a keyframe file with one 'time model x y z' per line giving the offset of level model N (the N of its *N model key) from where the level places it. Frames follow the flythrough or the camera and are rendered at --fps until the last key of either");
+    auto temporalArg = cmd.add<bool>("temporal", false, "Reuse the lighting of the previous flythrough frame wherever the same surface is still in view, only newly revealed surfaces get their shadows and occlusion traced. Much faster for smooth paths, at the cost of small lighting errors");
     auto cameraListArg = cmd.add<bool>("camera-list", 'l', false, "Print the number of intermission cameras in the level file");
+    auto infoArg = cmd.add<bool>("info", false, "Print a JSON summary of the level file (cameras, light, face and texture counts, bounds) without loading its geometry");
     auto gammaArg = cmd.add<float>("gamma", 1.0f, "Apply gamma correction to the generated image");
+    auto mergeFacesArg = cmd.add<bool>("merge-faces", false, "Merge adjacent coplanar faces into larger polygons while loading, fewer polygons make tracing faster");
+    auto compressArg = cmd.add<bool>("compress", false, "Write a run-length encoded TGA file, much smaller for images with large flat areas");
+    auto cacheArg = cmd.add<std::string>("cache", "", "Path to a scene cache file, reused when it was built from the same level and loader options, rebuilt otherwise");
+    auto batchArg = cmd.add<std::string>("batch", "", "Path to a job manifest with the options of one render per line. Jobs share one thread pool, the next level is loaded while the current one traces and images are written while the next one traces");
     auto showHelp = cmd.add<bool>("help", false, "Display program usage information");
 
     auto cmdResult = cmd.parse(argc, argv);
@@ -47,6 +120,7 @@ AppConfig::ParseResult AppConfig::parse(int argc, char const * const * const arg
     imageFile = imageArg->getValue();
     width = widthArg->getValue();
     height = heightArg->getValue();
+    stripHeight = stripArg->getValue();
     detail = detailArg->getValue();
     occlusionRayCount = occlusionArg->getValue();
     occlusionStrength = occlusionStrengthArg->getValue();
@@ -54,16 +128,121 @@ AppConfig::ParseResult AppConfig::parse(int argc, char const * const * const arg
     ambientLight = ambientLightArg->getValue();
     overrideAmbientLight = ambientLightArg->isSet();
     threads = threadsArg->getValue();
-    cameraIdx = cameraArg->getValue();
+    if (!parseCameras(cameraArg->getValue(), &cameraIndices, &allCameras))
+    {
+        return ParseResult::CreateFailed("Invalid camera list: " + cameraArg->getValue());
+    }
+    cameraIdx = allCameras ? 0 : cameraIndices.front();
+    flythrough = flythroughArg->getValue();
+    frameRate = frameRateArg->getValue();
+    animation = animateArg->getValue();
+    temporal = temporalArg->getValue();
     cameraList = cameraListArg->getValue();
+    showInfo = infoArg->getValue();
     gamma = gammaArg->getValue();
+    mergeFaces = mergeFacesArg->getValue();
+    cacheFile = cacheArg->getValue();
+    batchFile = batchArg->getValue();
+    compressImage = compressArg->getValue();
+
+    imageFormat = imageFile == STANDARD_OUTPUT ? IMAGE_Y4M : IMAGE_TGA;
+    const std::string format = formatArg->getValue();
+    bool knownFormat = format.empty();
+    for (int ii = UTIL_ARRAY_SIZE(IMAGE_FORMAT_DATA) - 1; ii >= 0; --ii)
+    {
+        const auto& data = IMAGE_FORMAT_DATA[ii];
+        if (format.empty() ? endsWith(imageFile, data.extension) : format == data.name)
+        {
+            imageFormat = data.format;
+            knownFormat = true;
+        }
+    }
+
+    if (!knownFormat)
+    {
+        return ParseResult::CreateFailed("Unknown output format: " + format);
+    }
+
+    const std::string projectionName = projectionArg->getValue();
+    bool knownProjection = false;
+    for (int ii = UTIL_ARRAY_SIZE(PROJECTION_DATA) - 1; ii >= 0; --ii)
+    {
+        if (projectionName == PROJECTION_DATA[ii].name)
+        {
+            projection = PROJECTION_DATA[ii].projection;
+            knownProjection = true;
+        }
+    }
+
+    if (!knownProjection)
+    {
+        return ParseResult::CreateFailed("Unknown projection: " + projectionName);
+    }
+
+    if (projection == PROJECTION_CUBEMAP && width != height * 6)
+    {
+        return ParseResult::CreateFailed("Cube maps need a width of six times the height");
+    }
+
+    if (stripHeight < 0)
+    {
+        return ParseResult::CreateFailed("Strip height cannot be negative");
+    }
+
+    if (stripHeight > 0 && imageFormat != IMAGE_QOI && imageFormat != IMAGE_BGRA)
+    {
+        return ParseResult::CreateFailed("Strip rendering needs qoi or bgra output");
+    }
+
+    if (temporal && stripHeight > 0)
+    {
+        return ParseResult::CreateFailed("Temporal reuse keeps whole frames and does not work with strips");
+    }
+
+    if (temporal && projection != PROJECTION_PERSPECTIVE)
+    {
+        return ParseResult::CreateFailed("Temporal reuse only works with the perspective projection");
+    }
+
+    if (temporal && !animation.empty())
+    {
+        return ParseResult::CreateFailed("Temporal reuse cannot follow moving models");
+    }
+
+    if (!animation.empty() && flythrough.empty() && (allCameras || cameraIndices.size() > 1))
+    {
+        return ParseResult::CreateFailed("Model animation follows a flythrough or a single camera");
+    }
+
+    if (frameRate <= 0)
+    {
+        return ParseResult::CreateFailed("Frame rate has to be positive");
+    }
+
+    const bool multipleCameras = allCameras || cameraIndices.size() > 1 || !flythrough.empty() || !animation.empty();
+    const bool namedByCamera = imageFile.find(CAMERA_PLACEHOLDER) != std::string::npos;
+    if (multipleCameras && !namedByCamera && ((imageFormat != IMAGE_Y4M && imageFormat != IMAGE_BGRA) || stripHeight > 0))
+    {
+        return ParseResult::CreateFailed("Several cameras, flythroughs and animations need a %d in the output path, or y4m or bgra output without strips");
+    }
+
+    if (imageFormat == IMAGE_TGA && (width > MAX_TGA_SIZE || height > MAX_TGA_SIZE))
+    {
+        return ParseResult::CreateFailed("TGA images cannot be larger than 65535 pixels, use qoi or bgra output");
+    }
+
+    if (!batchFile.empty())
+    {
+        // Every job in the manifest brings its own level and output
+        return ParseResult::CreateSuccess();
+    }
 
     if (mapFile.empty())
     {
         return ParseResult::CreateFailed("No map file specified");
     }
 
-    if (imageFile.empty() && !cameraList)
+    if (imageFile.empty() && !cameraList && !showInfo)
     {
         return ParseResult::CreateFailed("No image file specified");
     }
@@ -1,9 +1,29 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 struct AppConfig
 {
+    enum ImageFormat
+    {
+        IMAGE_TGA,
+        IMAGE_QOI,
+        IMAGE_Y4M,
+        IMAGE_BGRA,
+    };
+
+    enum Projection
+    {
+        PROJECTION_PERSPECTIVE,
+        PROJECTION_CUBEMAP,
+        PROJECTION_EQUIRECT,
+    };
+
+    static const char* const STANDARD_OUTPUT; // Output file name that writes to stdout
+    static const char* const CAMERA_PLACEHOLDER; // Replaced by the camera index or frame number in the output file name
+    static const char* const PATH_CORNER_FLYTHROUGH; // Flythrough source that follows the path_corner entities of the level
+
     struct ParseResult
     {
         enum Result
@@ -40,11 +60,23 @@ struct AppConfig
 
     std::string mapFile;
     std::string imageFile;
-    int cameraIdx;
+    ImageFormat imageFormat;
+    std::string cacheFile;
+    std::string batchFile;
+    int cameraIdx; // First camera in the list
+    std::vector<int> cameraIndices;
+    bool allCameras;
+    std::string flythrough;
+    int frameRate;
+    std::string animation;
+    bool temporal;
     bool cameraList;
+    bool showInfo;
 
     int width;
     int height;
+    int stripHeight; // Rows per strip when rendering out of core, 0 renders the whole image at once
+    Projection projection;
 
     int detail;
     int softshadowRayCount;
@@ -53,6 +85,8 @@ struct AppConfig
     float ambientLight;
     bool overrideAmbientLight;
     float gamma;
+    bool mergeFaces;
+    bool compressImage;
 
     int threads;
 };
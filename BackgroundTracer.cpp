@@ -1,6 +1,5 @@
 #include "BackgroundTracer.hpp"
 #include "Assert.hpp"
-#include "Scene.hpp"
 
 BackgroundTracer::BackgroundTracer(const RayTracer::Config& config)
 : running(false)
@@ -16,10 +15,10 @@ BackgroundTracer::~BackgroundTracer()
     if (thread.joinable()) { thread.join(); }
 }
 
-void BackgroundTracer::startTrace(const Scene& scene, const Camera& camera)
+void BackgroundTracer::startTrace(const ScenePtr& scene, const Camera& camera)
 {
     ASSERT(this->scene == nullptr);
-    this->scene.reset(new Scene(scene));
+    this->scene = scene;
     this->camera.reset(new Camera(camera));
 
     if (!running)
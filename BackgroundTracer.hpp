@@ -1,6 +1,7 @@
 #pragma once
 
 #include "RayTracer.hpp"
+#include "Scene.hpp"
 #include <memory>
 #include <thread>
 
@@ -10,10 +11,11 @@ public:
     BackgroundTracer(const RayTracer::Config& config);
     ~BackgroundTracer();
 
-    void startTrace(const Scene& scene, const Camera& camera);
+    void startTrace(const ScenePtr& scene, const Camera& camera);
     float getProgress() { return engine.getProgress(); }
     const Image& getCanvas() const { return canvas; }
     bool isTracing() const { return running; }
+    bool isRowFinished(int row) const { return engine.isRowFinished(row); }
     void setBreakPoint(int x, int y) { engine.setBreakPoint(x, y); }
     void resetBreakPoint() { engine.resetBreakPoint(); }
 
@@ -23,7 +25,7 @@ private:
 
     bool running;
     RayTracer engine;
-    std::unique_ptr<Scene> scene;
+    ScenePtr scene;
     std::unique_ptr<Camera> camera;
     Image canvas;
 
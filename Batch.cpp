@@ -0,0 +1,253 @@
+#include "Batch.hpp"
+#include "Common.hpp"
+#include "File.hpp"
+#include "Scene.hpp"
+#include "RayTracer.hpp"
+#include "Scheduler.hpp"
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <cctype>
+
+namespace {
+    static const char PROGRAM_NAME[] = "quaketrace"; // Stands in for argv[0] when parsing a manifest line
+    static const char COMMENT_PREFIX = '#';
+
+    inline bool isSpace(char ch) { return std::isspace(static_cast<unsigned char>(ch)) != 0; }
+
+    std::vector<std::string> splitArguments(const char* begin, const char* end)
+    {
+        std::vector<std::string> arguments;
+        const char* ch = begin;
+        while (ch < end)
+        {
+            if (isSpace(*ch))
+            {
+                ++ch;
+                continue;
+            }
+
+            std::string argument;
+            bool quoted = false;
+            for (; ch < end && (quoted || !isSpace(*ch)); ++ch)
+            {
+                if (*ch == '"')
+                {
+                    quoted = !quoted;
+                }
+                else
+                {
+                    argument.push_back(*ch);
+                }
+            }
+            arguments.push_back(argument);
+        }
+        return arguments;
+    }
+
+    bool loadLevel(const AppConfig& config, Scheduler* scheduler, Scene* scene)
+    {
+        BspLoader::Options options = common::parseLoaderOptions(config);
+        options.scheduler = scheduler;
+        if (!common::loadBSP(config.mapFile.c_str(), options, config.cacheFile, scene, config.width, config.height))
+        {
+            return false;
+        }
+
+        if (config.overrideAmbientLight)
+        {
+            scene->lighting.ambient = config.ambientLight;
+        }
+        return true;
+    }
+
+    // One image on its way from the tracer to disk
+    struct Frame
+    {
+        Frame() : canvas(0, 0, Image::FORMAT_ARGB), config(nullptr) {}
+
+        std::unique_ptr<RayTracer> engine;
+        Image canvas;
+        ScenePtr scene; // Kept alive until the trace is finished
+        const AppConfig* config;
+        std::string filename;
+        std::thread writer;
+    };
+}
+
+bool batch::readManifest(const char* filename, std::vector<AppConfig>* jobs, std::string* error)
+{
+    FileMapping manifest = FileMapping::open(filename);
+    if (!manifest.isValid())
+    {
+        *error = std::string("Could not open manifest: ") + filename;
+        return false;
+    }
+
+    const char* text = static_cast<const char*>(manifest.getData());
+    const char* textEnd = text + manifest.size();
+    int lineNumber = 0;
+    for (const char* line = text; line < textEnd; )
+    {
+        const char* lineEnd = line;
+        while (lineEnd < textEnd && *lineEnd != '\n') { ++lineEnd; }
+        ++lineNumber;
+
+        std::vector<std::string> arguments = splitArguments(line, lineEnd);
+        line = lineEnd + 1;
+        if (arguments.empty() || arguments.front()[0] == COMMENT_PREFIX)
+        {
+            continue;
+        }
+
+        std::vector<const char*> argv(1, PROGRAM_NAME);
+        for (const auto& argument : arguments)
+        {
+            argv.push_back(argument.c_str());
+        }
+
+        const std::string location = "Line " + std::to_string(lineNumber) + ": ";
+        AppConfig job;
+        const auto result = job.parse(static_cast<int>(argv.size()), argv.data());
+        if (result.result != AppConfig::ParseResult::PARSE_SUCCESS)
+        {
+            *error = location + (result.result == AppConfig::ParseResult::PARSE_FAILED ? result.error : "--help is not a job");
+            return false;
+        }
+
+        if (job.stripHeight > 0 || job.cameraList || job.showInfo || !job.batchFile.empty() || !job.flythrough.empty() || !job.animation.empty())
+        {
+            *error = location + "--strip, --info, --camera-list, --flythrough, --animate and --batch cannot be used in a job";
+            return false;
+        }
+
+        // Frames of one stream would interleave with the other jobs
+        if ((job.allCameras || job.cameraIndices.size() > 1) && job.imageFile.find(AppConfig::CAMERA_PLACEHOLDER) == std::string::npos)
+        {
+            *error = location + "Several cameras need a %d in the output path";
+            return false;
+        }
+
+        jobs->push_back(job);
+    }
+    return true;
+}
+
+int batch::render(const std::vector<AppConfig>& jobs, int threads, std::FILE* messages)
+{
+    std::atomic<int> failures(0);
+    Frame frames[2];
+    std::shared_ptr<Scene> nextScene;
+    bool nextLoaded = false;
+    std::thread loader;
+    // Declared last so the workers are stopped before anything they work on goes away
+    Scheduler scheduler(threads);
+
+    auto startLoading = [&](int jobIdx)
+    {
+        nextScene = std::make_shared<Scene>();
+        loader = std::thread([&, jobIdx]() { nextLoaded = loadLevel(jobs[jobIdx], &scheduler, nextScene.get()); });
+    };
+
+    auto finishFrame = [&](Frame* frame)
+    {
+        while (!frame->engine->isFinished())
+        {
+            std::this_thread::yield();
+        }
+        frame->scene.reset();
+
+        frame->writer = std::thread([&failures, &scheduler, messages, frame]()
+        {
+            if (common::writeImage(frame->canvas, frame->filename.c_str(), *frame->config, &scheduler))
+            {
+                std::fprintf(messages, "Wrote %s\n", frame->filename.c_str());
+            }
+            else
+            {
+                std::fprintf(messages, "Could not write to file: %s\n", frame->filename.c_str());
+                ++failures;
+            }
+        });
+    };
+
+    if (!jobs.empty())
+    {
+        startLoading(0);
+    }
+
+    Frame* tracingFrame = nullptr;
+    int frameCount = 0;
+    for (int jobIdx = 0; jobIdx < static_cast<int>(jobs.size()); ++jobIdx)
+    {
+        loader.join();
+        const ScenePtr scene = nextScene;
+        const bool loaded = nextLoaded;
+        if (jobIdx + 1 < static_cast<int>(jobs.size()))
+        {
+            startLoading(jobIdx + 1);
+        }
+
+        const AppConfig& config = jobs[jobIdx];
+        if (!loaded)
+        {
+            std::fprintf(messages, "Could not open map file: %s\n", config.mapFile.c_str());
+            ++failures;
+            continue;
+        }
+        std::fprintf(messages, "Loaded %s\n", config.mapFile.c_str());
+
+        std::vector<int> cameraIndices;
+        std::string error;
+        if (!common::resolveCameras(config, *scene, &cameraIndices, &error))
+        {
+            std::fprintf(messages, "%s\n", error.c_str());
+            ++failures;
+            continue;
+        }
+
+        const RayTracer::Config traceConfig = common::parseRayTracerConfig(config);
+        for (int cameraIdx : cameraIndices)
+        {
+            // Once every row of the previous frame is handed out, workers that run idle can move on to this one
+            while (scheduler.hasQueuedTasks())
+            {
+                std::this_thread::yield();
+            }
+
+            Frame& frame = frames[frameCount++ % 2];
+            if (frame.writer.joinable())
+            {
+                frame.writer.join();
+            }
+            if (frame.canvas.width != config.width || frame.canvas.height != config.height)
+            {
+                frame.canvas = Image(config.width, config.height, Image::FORMAT_ARGB);
+            }
+            frame.engine.reset(new RayTracer(traceConfig));
+            frame.scene = scene;
+            frame.config = &config;
+            frame.filename = common::formatOutputPath(config.imageFile, cameraIdx);
+            frame.engine->startTrace(*scene, scene->cameras[cameraIdx], 0, &frame.canvas, &scheduler);
+
+            if (tracingFrame)
+            {
+                finishFrame(tracingFrame);
+            }
+            tracingFrame = &frame;
+        }
+    }
+
+    if (tracingFrame)
+    {
+        finishFrame(tracingFrame);
+    }
+    for (auto& frame : frames)
+    {
+        if (frame.writer.joinable())
+        {
+            frame.writer.join();
+        }
+    }
+    return failures;
+}
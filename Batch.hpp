@@ -0,0 +1,17 @@
+#pragma once
+
+#include "AppConfig.hpp"
+#include <vector>
+#include <string>
+#include <cstdio>
+
+// Renders a list of jobs from a manifest that holds the command line options of one render per line
+namespace batch
+{
+    // Blank lines and lines starting with # are skipped, arguments with spaces can be put in double quotes
+    bool readManifest(const char* filename, std::vector<AppConfig>* jobs, std::string* error);
+
+    // All jobs share one pool of workers. The next level is loaded while the current one traces,
+    // and each image is written on its own thread while the next one traces. Returns the number of failures.
+    int render(const std::vector<AppConfig>& jobs, int threads, std::FILE* messages);
+};
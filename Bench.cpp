@@ -0,0 +1,365 @@
+#include "Scene.hpp"
+#include "RayTracer.hpp"
+#include "BspLoader.hpp"
+#include "Common.hpp"
+#include "CommandLine.hpp"
+#include "File.hpp"
+#include "Image.hpp"
+#include "Random.hpp"
+#include "Logger.hpp"
+#include "Util.hpp"
+#include "Math.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Renders fixed scenes at fixed quality presets and thread counts and reports timings and ray throughput as JSON
+
+namespace {
+    static const int DEFAULT_WIDTH = 160;
+    static const int DEFAULT_HEIGHT = 120;
+    static const int DEFAULT_REPEAT = 3;
+    static const unsigned int BENCH_SEED = 1;
+    static const int OCCLUSION_STRENGTH = 16;
+    static const float FOV = 60;
+    static const char ALL_PRESETS[] = "all";
+
+    struct Preset
+    {
+        const char* name;
+        int detail;
+        int softshadowRayCount;
+        int occlusionRayCount;
+    };
+
+    static const Preset PRESETS[] = {
+        { "preview",    1,  0,  0,  },
+        { "default",    1,  10, 32, },
+        { "high",       2,  16, 64, },
+    };
+
+    struct BenchScene
+    {
+        std::string name;
+        std::unique_ptr<Scene> scene;
+    };
+
+    struct Run
+    {
+        const BenchScene* scene;
+        const Preset* preset;
+        int threads;
+        double seconds; // Fastest of the repeated renders
+        RayCount rays;
+    };
+
+    bool parseIntegers(const std::string& text, std::vector<int>* values)
+    {
+        const char* next = text.c_str();
+        do
+        {
+            char* end;
+            const long value = std::strtol(next, &end, 10);
+            if (end == next || value <= 0 || (*end != ',' && *end != '\0')) { return false; }
+            values->push_back(static_cast<int>(value));
+            next = *end ? end + 1 : end;
+        } while (*next);
+        return !values->empty();
+    }
+
+    const std::vector<std::string> splitList(const std::string& text)
+    {
+        std::vector<std::string> items;
+        size_t start = 0;
+        while (start < text.size())
+        {
+            size_t end = text.find(',', start);
+            if (end == std::string::npos) { end = text.size(); }
+            if (end > start) { items.push_back(text.substr(start, end - start)); }
+            start = end + 1;
+        }
+        return items;
+    }
+
+    void addQuad(std::vector<Scene::ConvexPolygon>* polygons, const math::Vec3f& corner, const math::Vec3f& u, const math::Vec3f& v, int material)
+    {
+        // Same winding as the polygon of the default scene
+        const std::vector<math::Vec3f> vertices = {corner, corner + u, corner + u + v, corner + v};
+        auto polygon = Scene::ConvexPolygon::create(vertices, math::normalized(math::cross(v, u)), material);
+        polygon.flags[Scene::ConvexPolygon::FLAG_SHADOWCAST] = true;
+        polygons->push_back(polygon);
+    }
+
+    int addBox(Scene* scene, const math::Vec3f& min, const math::Vec3f& max, int material, bool inward)
+    {
+        const math::Vec3f size = max - min;
+        const math::Vec3f x{size.x, 0.0f, 0.0f};
+        const math::Vec3f y{0.0f, size.y, 0.0f};
+        const math::Vec3f z{0.0f, 0.0f, size.z};
+        // Each face points along cross(v, u), swapping the edges turns the box inside out
+        const struct { math::Vec3f corner, u, v; } faces[] = {
+            { {min.x, min.y, max.z}, y, x },
+            { min, x, y },
+            { {max.x, min.y, min.z}, z, y },
+            { min, y, z },
+            { {min.x, max.y, min.z}, x, z },
+            { min, z, x },
+        };
+
+        std::vector<Scene::ConvexPolygon> polygons;
+        for (const auto& face : faces)
+        {
+            addQuad(&polygons, face.corner, inward ? face.v : face.u, inward ? face.u : face.v, material);
+        }
+        math::BoundingBox bounds = math::BoundingBox::createEmpty();
+        bounds.add(min);
+        bounds.add(max);
+        return scene->addModel(polygons, bounds);
+    }
+
+    void setLens(Camera* camera, int width, int height)
+    {
+        const float halfViewAngle = std::tan(math::deg2rad(FOV)) / 2.0f;
+        camera->halfViewAngles.set(halfViewAngle, halfViewAngle * height / static_cast<float>(width));
+    }
+
+    // A closed room with a grid of pillars lit by point lights, enough instances and shadows to keep the hierarchies busy
+    void createPillarScene(Scene* scene, int width, int height)
+    {
+        static const int PILLAR_GRID = 6;
+        static const float PILLAR_SPACING = 128.0f;
+
+        Scene::Material material;
+        material.color = Color(0.8f, 0.7f, 0.6f);
+        scene->materials.push_back(material);
+        const int materialIdx = util::lastIndex(scene->materials);
+
+        const int room = addBox(scene, {-512.0f, -512.0f, 0.0f}, {512.0f, 512.0f, 256.0f}, materialIdx, true);
+        scene->addInstance(room, {0.0f, 0.0f, 0.0f});
+        const int pillar = addBox(scene, {-16.0f, -16.0f, 0.0f}, {16.0f, 16.0f, 192.0f}, materialIdx, false);
+        for (int ii = PILLAR_GRID * PILLAR_GRID - 1; ii >= 0; --ii)
+        {
+            const float offset = (PILLAR_GRID - 1) * 0.5f;
+            scene->addInstance(pillar, {(ii % PILLAR_GRID - offset) * PILLAR_SPACING, (ii / PILLAR_GRID - offset) * PILLAR_SPACING, 0.0f});
+        }
+        scene->buildInstanceBvh();
+
+        scene->lighting.add(Lighting::Point({-256.0f, -256.0f, 224.0f}, 400.0f, 16.0f));
+        scene->lighting.add(Lighting::Point({256.0f, -256.0f, 224.0f}, 400.0f, 16.0f));
+        scene->lighting.add(Lighting::Point({-256.0f, 256.0f, 224.0f}, 400.0f, 16.0f));
+        scene->lighting.add(Lighting::Point({256.0f, 256.0f, 224.0f}, 400.0f, 16.0f));
+        scene->lighting.ambient = 0.1f;
+
+        scene->cameras.resize(1);
+        scene->cameras[0].setPosition({-480.0f, -480.0f, 160.0f}, math::normalized(math::Vec3f(1.0f, 1.0f, -0.3f)), {0.0f, 0.0f, 1.0f});
+        setLens(&scene->cameras[0], width, height);
+    }
+
+    const Run measure(const BenchScene& benchScene, const Preset& preset, int threads, int width, int height, int repeat)
+    {
+        RayTracer::Config config;
+        config.width = width;
+        config.height = height;
+        config.detail = preset.detail;
+        config.projection = RayTracer::PROJECTION_PERSPECTIVE;
+        config.softshadowRayCount = preset.softshadowRayCount;
+        config.occlusionRayCount = preset.occlusionRayCount;
+        config.occlusionRayStrength = OCCLUSION_STRENGTH;
+        config.gamma = 1.0f;
+        config.temporal = false;
+        config.threads = threads;
+
+        Run run = {&benchScene, &preset, threads, 0.0, {0, 0, 0}};
+        RayTracer engine(config);
+        Image canvas(width, height, Image::FORMAT_ARGB);
+        for (int ii = 0; ii < repeat; ++ii)
+        {
+            // Threads still draw from the shared generator in any order, the seed only fixes where the sequence starts
+            util::Random::setGlobalSeed(BENCH_SEED);
+            const auto start = std::chrono::steady_clock::now();
+            engine.trace(*benchScene.scene, benchScene.scene->cameras.front(), &canvas);
+            const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            if (ii == 0 || elapsed.count() < run.seconds)
+            {
+                run.seconds = elapsed.count();
+                run.rays = engine.getRayCount();
+            }
+        }
+        return run;
+    }
+
+    // Scene names come from the command line, so quotes, backslashes and control characters have to be escaped
+    void appendString(std::string* json, const std::string& text)
+    {
+        json->push_back('"');
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+            {
+                json->push_back('\\');
+                json->push_back(c);
+            }
+            else if (static_cast<unsigned char>(c) < 0x20)
+            {
+                char escaped[8];
+                std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned>(c));
+                json->append(escaped);
+            }
+            else
+            {
+                json->push_back(c);
+            }
+        }
+        json->push_back('"');
+    }
+
+    void appendNumber(std::string* json, const char* format, double value)
+    {
+        char buffer[64];
+        std::snprintf(buffer, sizeof(buffer), format, value);
+        json->append(buffer);
+    }
+
+    void appendRun(std::string* json, const Run& run, double efficiency)
+    {
+        const double seconds = math::max(run.seconds, 1e-9);
+        const std::uint64_t total = run.rays.primary + run.rays.shadow + run.rays.occlusion;
+        json->append("{\"scene\":");
+        appendString(json, run.scene->name);
+        json->append(",\"preset\":");
+        appendString(json, run.preset->name);
+        json->append(",\"threads\":" + std::to_string(run.threads));
+        json->append(",\"seconds\":");
+        appendNumber(json, "%.6f", run.seconds);
+        json->append(",\"rays\":{\"primary\":" + std::to_string(run.rays.primary));
+        json->append(",\"shadow\":" + std::to_string(run.rays.shadow));
+        json->append(",\"occlusion\":" + std::to_string(run.rays.occlusion));
+        json->append("},\"rays_per_second\":{\"primary\":");
+        appendNumber(json, "%.0f", run.rays.primary / seconds);
+        json->append(",\"shadow\":");
+        appendNumber(json, "%.0f", run.rays.shadow / seconds);
+        json->append(",\"occlusion\":");
+        appendNumber(json, "%.0f", run.rays.occlusion / seconds);
+        json->append(",\"total\":");
+        appendNumber(json, "%.0f", total / seconds);
+        json->append("},\"scaling_efficiency\":");
+        appendNumber(json, "%.3f", efficiency);
+        json->append("}");
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    util::CommandLine cmd;
+    auto inputArg = cmd.add<std::string>("input", 'i', std::string(), "Comma separated list of level files to run besides the built-in synthetic scenes, like the compiled testmap");
+    auto outputArg = cmd.add<std::string>("output", 'o', std::string("-"), "Path of the JSON report, - writes to standard output");
+    auto widthArg = cmd.add<int>("width", 'w', DEFAULT_WIDTH, "Width of the rendered images");
+    auto heightArg = cmd.add<int>("height", 'h', DEFAULT_HEIGHT, "Height of the rendered images");
+    auto presetArg = cmd.add<std::string>("preset", std::string(ALL_PRESETS), "Quality presets to run: preview, default, high, a comma separated list of them or all");
+    auto threadsArg = cmd.add<std::string>("threads", 'j', std::string("1,2,4"), "Comma separated list of thread counts, scaling efficiency is relative to the lowest one");
+    auto repeatArg = cmd.add<int>("repeat", DEFAULT_REPEAT, "Renders per measurement, the fastest one is reported");
+    auto showHelp = cmd.add<bool>("help", false, "Display program usage information");
+
+    auto cmdResult = cmd.parse(argc, argv);
+    if (!cmdResult.success)
+    {
+        std::printf("Parse failed: %s\n", cmdResult.error.c_str());
+        return EXIT_FAILURE;
+    }
+
+    if (showHelp->getValue())
+    {
+        std::printf("%s\n", cmd.createHelpString(argv[0]).c_str());
+        return EXIT_SUCCESS;
+    }
+
+    const int width = widthArg->getValue();
+    const int height = heightArg->getValue();
+    const int repeat = repeatArg->getValue();
+    std::vector<int> threadCounts;
+    if (!parseIntegers(threadsArg->getValue(), &threadCounts))
+    {
+        std::printf("Invalid thread counts: %s\n", threadsArg->getValue().c_str());
+        return EXIT_FAILURE;
+    }
+    std::sort(threadCounts.begin(), threadCounts.end());
+
+    if (width <= 0 || height <= 0 || repeat <= 0)
+    {
+        std::printf("Size and repeat count have to be positive\n");
+        return EXIT_FAILURE;
+    }
+
+    std::vector<const Preset*> presets;
+    for (const std::string& name : splitList(presetArg->getValue()))
+    {
+        const size_t presetCount = presets.size();
+        for (const Preset& preset : PRESETS)
+        {
+            if (name == preset.name || name == ALL_PRESETS) { presets.push_back(&preset); }
+        }
+        if (presets.size() == presetCount)
+        {
+            std::printf("Unknown preset: %s\n", name.c_str());
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::vector<BenchScene> scenes;
+    scenes.push_back({"synthetic:primitives", std::unique_ptr<Scene>(new Scene())});
+    Scene::initDefault(scenes.back().scene.get());
+    setLens(&scenes.back().scene->cameras.front(), width, height);
+    scenes.push_back({"synthetic:pillars", std::unique_ptr<Scene>(new Scene())});
+    createPillarScene(scenes.back().scene.get(), width, height);
+
+    BspLoader::Options loaderOptions;
+    loaderOptions.threads = threadCounts.back();
+    for (const std::string& mapFile : splitList(inputArg->getValue()))
+    {
+        std::unique_ptr<Scene> scene(new Scene());
+        if (!common::loadBSP(mapFile.c_str(), loaderOptions, "", scene.get(), width, height) || scene->cameras.empty())
+        {
+            std::printf("Could not open map file: %s\n", mapFile.c_str());
+            return EXIT_FAILURE;
+        }
+        scenes.push_back({mapFile, std::move(scene)});
+    }
+
+    char header[256];
+    std::snprintf(header, sizeof(header), "{\"width\":%d,\"height\":%d,\"repeat\":%d,\"runs\":[", width, height, repeat);
+    std::string json = header;
+    bool firstRun = true;
+    for (const BenchScene& scene : scenes)
+    {
+        for (const Preset* preset : presets)
+        {
+            double baseCost = 0.0;
+            for (int threads : threadCounts)
+            {
+                LOG("%s, %s, %d threads\n", scene.name.c_str(), preset->name, threads);
+                const Run run = measure(scene, *preset, threads, width, height, repeat);
+                // Thread seconds spent per image, against the cost at the lowest thread count
+                const double cost = run.seconds * threads;
+                if (threads == threadCounts.front()) { baseCost = cost; }
+
+                json.append(firstRun ? "" : ",");
+                appendRun(&json, run, cost > 0.0 ? baseCost / cost : 1.0);
+                firstRun = false;
+            }
+        }
+    }
+    json.append("]}\n");
+
+    File output = common::openOutput(outputArg->getValue().c_str());
+    if (!output.isValid() || output.write(json.data(), json.size()) != 1)
+    {
+        std::printf("Could not write to file: %s\n", outputArg->getValue().c_str());
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
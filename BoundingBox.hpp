@@ -0,0 +1,54 @@
+#pragma once
+
+#include "Vec3.hpp"
+#include <limits>
+
+namespace math
+{
+    struct BoundingBox
+    {
+        Vec3f min;
+        Vec3f max;
+
+        static const BoundingBox createEmpty()
+        {
+            const float inf = std::numeric_limits<float>::infinity();
+            return {{inf, inf, inf}, {-inf, -inf, -inf}};
+        }
+
+        inline void add(const Vec3f& point)
+        {
+            min.set(point.x < min.x ? point.x : min.x, point.y < min.y ? point.y : min.y, point.z < min.z ? point.z : min.z);
+            max.set(point.x > max.x ? point.x : max.x, point.y > max.y ? point.y : max.y, point.z > max.z ? point.z : max.z);
+        }
+
+        inline void add(const BoundingBox& box)
+        {
+            if (box.isEmpty()) { return; }
+            add(box.min);
+            add(box.max);
+        }
+
+        inline bool isEmpty() const
+        {
+            return min.x > max.x || min.y > max.y || min.z > max.z;
+        }
+
+        inline const Vec3f getCenter() const
+        {
+            return (min + max) * 0.5f;
+        }
+
+        inline const float getSurfaceArea() const
+        {
+            if (isEmpty()) { return 0.0f; }
+            const Vec3f size = max - min;
+            return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+        }
+
+        inline const BoundingBox translated(const Vec3f& offset) const
+        {
+            return {min + offset, max + offset};
+        }
+    };
+}
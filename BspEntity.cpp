@@ -1,26 +1,15 @@
 #include "BspEntity.hpp"
-#include <cstdio>
+#include <cctype>
 #include "Util.hpp"
 #include "StringTool.hpp"
 
-static const std::string ENTITY_TYPE_KEY = "classname";
-struct
-{
-    const char* classname;
-    BspEntity::Type type;
-} ENTITY_TYPE_DATA[] = {
-    { "worldspawn", BspEntity::TYPE_WORLD_SPAWN, },
-    { "info_player_start", BspEntity::TYPE_PLAYER_START, },
-    { "info_intermission", BspEntity::TYPE_INTERMISSION_CAMERA, },
-    { "light", BspEntity::TYPE_LIGHT, },
-    { "light_fluoro", BspEntity::TYPE_LIGHT, },
-    { "light_fluorospark", BspEntity::TYPE_LIGHT, },
-    { "light_globe", BspEntity::TYPE_LIGHT, },
-    { "light_flame_large_yellow", BspEntity::TYPE_LIGHT, },
-    { "light_flame_small_yellow", BspEntity::TYPE_LIGHT, },
-    { "light_flame_small_white", BspEntity::TYPE_LIGHT, },
-    { "light_torch_small_walltorch", BspEntity::TYPE_LIGHT, },
-};
+namespace {
+    // The hash only picks a candidate, the classname itself has to match as well
+    inline BspEntity::Type matchType(const util::StringView& classname, const char* name, BspEntity::Type type)
+    {
+        return classname == name ? type : BspEntity::TYPE_OTHER;
+    }
+}
 
 enum KeyType
 {
@@ -51,127 +40,130 @@ struct
     { "targetname",     BspEntity::Property::KEY_TARGETNAME, TYPE_STRING, },
 };
 
-static const std::vector<std::string> extractKeyNames()
-{
-    std::vector<std::string> names(BspEntity::Property::NUM_KEYS);
-    for (int ii = 0; ii < BspEntity::Property::NUM_KEYS; ++ii)
+BspEntity::Property BspEntity::Property::NULL_PROPERTY;
+
+namespace {
+    inline void skipWhitespace(const util::ArrayView<char>& serialized, int* idx)
     {
-        names[ii] = ENTITY_PROPERTY_KEY_DATA[ii].keyName;
+        while (*idx < serialized.size && std::isspace(static_cast<unsigned char>(serialized[*idx]))) { ++*idx; }
     }
-    return names;
-}
 
-static const std::vector<std::string> extractClassNames()
-{
-    std::vector<std::string> names(UTIL_ARRAY_SIZE(ENTITY_TYPE_DATA));
-    for (int ii = 0; ii < UTIL_ARRAY_SIZE(ENTITY_TYPE_DATA); ++ii)
+    // Reads a quoted token starting at idx, leaves idx after the closing quote
+    bool readQuoted(const util::ArrayView<char>& serialized, int* idx, util::StringView* token)
     {
-        names[ii] = ENTITY_TYPE_DATA[ii].classname;
+        if (*idx >= serialized.size || serialized[*idx] != '"') { return false; }
+        const int start = *idx + 1;
+        int end = start;
+        while (end < serialized.size && serialized[end] != '"' && serialized[end] != '\n') { ++end; }
+        if (end >= serialized.size || serialized[end] != '"') { return false; }
+        *token = {serialized.array + start, end - start};
+        *idx = end + 1;
+        return true;
     }
-    return names;
 }
 
-static const std::vector<std::string> KEY_NAMES = extractKeyNames();
-static const std::vector<std::string> CLASS_NAMES = extractClassNames();
-
-BspEntity::Property BspEntity::Property::NULL_PROPERTY;
-
 std::vector<BspEntity> BspEntity::parseList(const util::ArrayView<char>& serialized)
 {
     std::vector<BspEntity> entities;
-    for (int ii = 0; ii < serialized.size; ++ii)
+    BspEntity* entity = nullptr;
+    for (int ii = 0; ii < serialized.size;)
     {
-        if (serialized[ii] == '{')
+        switch (serialized[ii])
         {
-            int entityStart = ii;
-            int indent = 1;
-            while (++ii < serialized.size && indent)
-            {
-                char tok = serialized[ii];
-                if (tok == '}') { --indent; }
-                else if (tok == '{') { ++indent; }
-            }
-            const BspEntity entity = parse(serialized.slice(entityStart, ii));
-            entities.push_back(entity);
+            case '{':
+                entities.emplace_back();
+                entity = &entities.back();
+                ++ii;
+                break;
+            case '}':
+                if (entity && entity->hasProperty(Property::KEY_CLASSNAME))
+                {
+                    entity->type = lookupType(entity->getProperty(Property::KEY_CLASSNAME).value);
+                }
+                entity = nullptr;
+                ++ii;
+                break;
+            case '"':
+                {
+                    util::StringView keyName, value;
+                    if (!readQuoted(serialized, &ii, &keyName))
+                    {
+                        // Unterminated key, skip the rest of the line
+                        while (ii < serialized.size && serialized[ii] != '\n') { ++ii; }
+                        break;
+                    }
+                    skipWhitespace(serialized, &ii);
+                    if (!entity || !readQuoted(serialized, &ii, &value)) { break; }
+
+                    const Property property = Property::parse(keyName, value);
+                    if (property.key != Property::KEY_OTHER)
+                    {
+                        entity->properties[property.key] = property;
+                    }
+                }
+                break;
+            default:
+                ++ii;
+                break;
         }
     }
     return entities;
 }
 
-const BspEntity BspEntity::parse(const util::ArrayView<char>& serialized)
+BspEntity::Type BspEntity::lookupType(const util::StringView& classname)
 {
-    BspEntity entity;
-
-    for (int ii = 0; ii < serialized.size; ++ii)
+    // Names that share a hash would give duplicate labels and fail to compile, other names are rejected by matchType
+    switch (classname.hash())
     {
-        if (serialized[ii] == '"')
-        {
-            int propStart = ii;
-            while(ii < serialized.size && serialized[ii] != '\n') { ++ii; }
-            Property prop = Property::parse(serialized.slice(propStart, ii));
-            entity.properties.push_back(prop);
-
-            if (prop.key != Property::KEY_OTHER)
-            {
-                entity.keyIndices[prop.key] = util::lastIndex(entity.properties);
-            }
-        }
+        case util::hashString("worldspawn"): return matchType(classname, "worldspawn", TYPE_WORLD_SPAWN);
+        case util::hashString("info_player_start"): return matchType(classname, "info_player_start", TYPE_PLAYER_START);
+        case util::hashString("info_intermission"): return matchType(classname, "info_intermission", TYPE_INTERMISSION_CAMERA);
+        case util::hashString("light"): return matchType(classname, "light", TYPE_LIGHT);
+        case util::hashString("light_fluoro"): return matchType(classname, "light_fluoro", TYPE_LIGHT);
+        case util::hashString("light_fluorospark"): return matchType(classname, "light_fluorospark", TYPE_LIGHT);
+        case util::hashString("light_globe"): return matchType(classname, "light_globe", TYPE_LIGHT);
+        case util::hashString("light_flame_large_yellow"): return matchType(classname, "light_flame_large_yellow", TYPE_LIGHT);
+        case util::hashString("light_flame_small_yellow"): return matchType(classname, "light_flame_small_yellow", TYPE_LIGHT);
+        case util::hashString("light_flame_small_white"): return matchType(classname, "light_flame_small_white", TYPE_LIGHT);
+        case util::hashString("light_torch_small_walltorch"): return matchType(classname, "light_torch_small_walltorch", TYPE_LIGHT);
+        case util::hashString("path_corner"): return matchType(classname, "path_corner", TYPE_PATH_CORNER);
+        default: return TYPE_OTHER;
     }
-
-    if (entity.hasProperty(Property::KEY_CLASSNAME))
-    {
-        const Property& prop = entity.getProperty(Property::KEY_CLASSNAME);
-        const util::ArrayView<std::string> view = { CLASS_NAMES.data(), static_cast<int>(CLASS_NAMES.size()) };
-        int idx = util::findItemInArray(view, prop.value);
-        entity.type = ENTITY_TYPE_DATA[idx].type;
-    }
-
-    return entity;
 }
 
-const BspEntity::Property BspEntity::Property::parse(const util::ArrayView<char>& serialized)
+BspEntity::Property::Key BspEntity::Property::lookupKey(const util::StringView& keyName)
 {
-    Property property;
-    bool key = true;
-    for (int ii = 0; ii < serialized.size; ++ii)
+    Key key = KEY_OTHER;
+    switch (keyName.hash())
     {
-        if (serialized[ii] == '"')
-        {
-            ++ii;
-            int start = ii;
-            while (ii < serialized.size && serialized[ii] != '"')
-            {
-                ++ii;
-            }
-            if (key)
-            {
-                property.keyName = std::string(serialized.array + start, ii - start);
-                key = false;
-            }
-            else
-            {
-                property.value = std::string(serialized.array + start, ii - start);
-            }
-        }
+        case util::hashString("classname"): key = KEY_CLASSNAME; break;
+        case util::hashString("origin"): key = KEY_ORIGIN; break;
+        case util::hashString("mangle"): key = KEY_MANGLE; break;
+        case util::hashString("angle"): key = KEY_ANGLE; break;
+        case util::hashString("_light"): key = KEY_LIGHT; break;
+        case util::hashString("wait"): key = KEY_WAIT; break;
+        case util::hashString("delay"): key = KEY_DELAY; break;
+        case util::hashString("color"): key = KEY_COLOR; break;
+        case util::hashString("model"): key = KEY_MODEL; break;
+        case util::hashString("target"): key = KEY_TARGET; break;
+        case util::hashString("targetname"): key = KEY_TARGETNAME; break;
+        default: break;
     }
-
-    const util::ArrayView<std::string> view = { KEY_NAMES.data(), static_cast<int>(KEY_NAMES.size()) };
-    int idx = util::findItemInArray(view, property.keyName);
-    if (idx > -1)
+    if (key != KEY_OTHER && keyName == ENTITY_PROPERTY_KEY_DATA[key].keyName)
     {
-        property.key = ENTITY_PROPERTY_KEY_DATA[idx].key;
+        return key;
     }
-    else
-    {
-        property.key = KEY_OTHER;
-        
-        // Needed for some custom lights
-        if (!std::strncmp(property.keyName.c_str(), "light", 5))
-        {
-            property.key = KEY_LIGHT;
-        }
 
-    }
+    // Needed for some custom lights
+    return keyName.startsWith("light") ? KEY_LIGHT : KEY_OTHER;
+}
+
+const BspEntity::Property BspEntity::Property::parse(const util::StringView& keyName, const util::StringView& value)
+{
+    Property property;
+    property.keyName = keyName;
+    property.value = value;
+    property.key = lookupKey(keyName);
 
     if (property.key != KEY_OTHER)
     {
@@ -179,17 +171,21 @@ const BspEntity::Property BspEntity::Property::parse(const util::ArrayView<char>
         switch(keyData.type)
         {
             case TYPE_VEC:
-                util::StringTool::parseVec3f(property.value.c_str(), &property.vec);
+                util::StringTool::parseVec3f(property.value, &property.vec);
                 break;
             case TYPE_NUMBER:
-                util::StringTool::parseFloat(property.value.c_str(), &property.number);
+                util::StringTool::parseFloat(property.value, &property.number);
                 break;
             case TYPE_INTEGER:
-                util::StringTool::parseInteger(property.value.c_str(), &property.integer);
+                util::StringTool::parseInteger(property.value, &property.integer);
                 break;
             case TYPE_BRUSH:
-                ASSERT(property.value[0] == '*');
-                util::StringTool::parseInteger(property.value.c_str() + 1, &property.integer);
+                if (!property.value.startsWith("*")
+                    || !util::StringTool::parseInteger(util::StringView(property.value.data + 1, property.value.size - 1), &property.integer))
+                {
+                    // Alias models are not part of the level geometry
+                    property.key = KEY_OTHER;
+                }
                 break;
             case TYPE_STRING:
                 // fallthrough
@@ -198,6 +194,6 @@ const BspEntity::Property BspEntity::Property::parse(const util::ArrayView<char>
         }
     }
 
-    ASSERT(!property.keyName.empty() && !property.value.empty());
+    ASSERT(!property.keyName.empty());
     return property;
 }
@@ -1,9 +1,9 @@
 #pragma once
 
-#include <string>
 #include <vector>
 #include <array>
 #include "ArrayView.hpp"
+#include "StringView.hpp"
 #include "Math.hpp"
 
 struct BspEntity
@@ -15,6 +15,7 @@ struct BspEntity
         TYPE_PLAYER_START,
         TYPE_INTERMISSION_CAMERA,
         TYPE_LIGHT,
+        TYPE_PATH_CORNER,
         NUM_TYPES,
     };
 
@@ -39,8 +40,9 @@ struct BspEntity
 
         static Property NULL_PROPERTY;
 
-        std::string keyName;
-        std::string value;
+        // Views into the entity lump, which has to outlive the property
+        util::StringView keyName;
+        util::StringView value;
 
         Key key;
         math::Vec3f vec;
@@ -48,36 +50,29 @@ struct BspEntity
         int integer;
 
         Property() : key(KEY_OTHER), vec{0.0f, 0.0f, 0.0f}, number(0.0f), integer(0) {}
-        static const Property parse(const util::ArrayView<char>& serialized);
+        static const Property parse(const util::StringView& keyName, const util::StringView& value);
+        static Key lookupKey(const util::StringView& keyName);
     };
 
 
-    BspEntity();
+    BspEntity() : type(TYPE_OTHER) {}
     const bool hasProperty(Property::Key key) const;
     const Property& getProperty(Property::Key key) const;
 
-    static const BspEntity parse(const util::ArrayView<char>& serialized);
+    // Tokenizes the entity lump in a single pass, nothing is copied out of it
     static std::vector<BspEntity> parseList(const util::ArrayView<char>& serialized);
+    static Type lookupType(const util::StringView& classname);
 
-    std::array<int, Property::NUM_KEYS> keyIndices;
     Type type;
-    std::vector<Property> properties;
+    std::array<Property, Property::NUM_KEYS> properties; // Indexed by key, properties with unknown keys are skipped
 };
 
-inline BspEntity::BspEntity() : type(TYPE_OTHER)
-{
-    for (int ii = 0; ii < Property::NUM_KEYS; ++ii)
-    {
-        keyIndices[ii] = -1;
-    }
-}
-
 inline const bool BspEntity::hasProperty(Property::Key key) const
 {
-    return key != Property::KEY_OTHER && keyIndices[key] > -1;
+    return key != Property::KEY_OTHER && properties[key].key == key;
 }
 
 inline const BspEntity::Property& BspEntity::getProperty(Property::Key key) const
 {
-    return hasProperty(key) ? properties[keyIndices[key]] : Property::NULL_PROPERTY;
+    return hasProperty(key) ? properties[key] : Property::NULL_PROPERTY;
 }
@@ -6,9 +6,14 @@
 #include "AssetHelper.hpp"
 #include "BspEntity.hpp"
 #include "ArrayView.hpp"
+#include "Scheduler.hpp"
 #include <cstdint>
 #include <cstdlib>
 #include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <memory>
+#include <functional>
 
 using namespace std;
 
@@ -20,6 +25,16 @@ namespace {
     static const float LIGHT_SOURCE_RADIUS = 16;
     static const float DEFAULT_LIGHT_LEVEL = 300;
     static const float DEFAULT_SPOTLIGHT_ANGLE = 40;
+    static const float MERGE_VERTEX_EPSILON = 0.01f;
+    static const float MERGE_COLLINEAR_EPSILON = 0.001f;
+    static const float MIN_POLYGON_AREA = 0.5f;
+    static const int32_t BSP_VERSION = 29;
+    static const int32_t BSP2_VERSION = 'B' | ('S' << 8) | ('P' << 16) | ('2' << 24);      // "BSP2"
+    static const int32_t BSP2_RMQ_VERSION = '2' | ('P' << 8) | ('S' << 16) | ('B' << 24);  // "2PSB"
+    static const int MIN_CHUNK_SIZE = 64;
+    static const int LEVEL_PALETTE = 0;
+    static const int DUMMY_PALETTE = 1;
+    static const int CHUNKS_PER_THREAD = 4;
 
     enum Lumps
     {
@@ -113,6 +128,26 @@ namespace {
         uint16_t vertex_idx_end;
     };
 
+    // BSP2 and 2PSB widen faces and edges to 32 bits, the other lumps read by the loader are unchanged
+    struct Face2
+    {
+        int32_t plane_id;
+        int32_t side;
+        int32_t ledge_id;
+        int32_t ledge_num;
+        int32_t texinfo_id;
+        uint8_t typelight;
+        uint8_t baselight;
+        uint8_t light[2];
+        int32_t lightmap;
+    };
+
+    struct Edge2
+    {
+        uint32_t vertex_idx_start;
+        uint32_t vertex_idx_end;
+    };
+
     typedef Vec Vertex;
 
     struct BspNode
@@ -202,6 +237,11 @@ namespace {
         return { normal.x, normal.y, normal.z };
     }
 
+    inline math::BoundingBox bound2box(const BoundingBox& bound)
+    {
+        return { vert2vec3(bound.min), vert2vec3(bound.max) };
+    }
+
     inline Scene::Material info2material(const TextureInfo& info, const Color& c)
     {
         Scene::Material mat;
@@ -214,11 +254,6 @@ namespace {
         return mat;
     }
 
-    inline bool isFullBright(int index)
-    {
-        return index >= 224;
-    }
-
     template<typename T>
     static inline const util::ArrayView<T> entry2view(const void* data, const Entry& entry)
     {
@@ -228,6 +263,38 @@ namespace {
         return {array, size};
     }
 
+    inline bool isRangeInside(int64_t offset, int64_t size, int64_t containerSize)
+    {
+        return offset >= 0 && size >= 0 && offset + size <= containerSize;
+    }
+
+    bool isValidTextureLump(const void* data, const Entry& entry, int textureInfoCount)
+    {
+        if (entry.size == 0) { return textureInfoCount == 0; }
+        if (entry.size < static_cast<int32_t>(sizeof(int32_t))) { return false; }
+
+        const int32_t* textureOffsets = util::castFromMemory<int32_t>(data, entry.offset);
+        const int32_t textureCount = textureOffsets[0];
+        if (textureCount < 0 || !isRangeInside(sizeof(int32_t), int64_t(textureCount) * sizeof(int32_t), entry.size))
+        {
+            return false;
+        }
+        for (int ii = 1; ii <= textureCount; ++ii)
+        {
+            const int32_t offset = textureOffsets[ii];
+            if (offset == -1) { continue; }
+            if (!isRangeInside(offset, sizeof(MipsTexture), entry.size)) { return false; }
+            auto def = util::castFromMemory<MipsTexture>(data, entry.offset + offset);
+            if (def->width == 0 || def->height == 0) { return false; }
+            for (int mip = 0; mip < MipsTexture::NUM_MIPS; ++mip)
+            {
+                const int64_t pixelCount = int64_t(def->width >> mip) * (def->height >> mip);
+                if (!isRangeInside(int64_t(offset) + def->offset[mip], pixelCount, entry.size)) { return false; }
+            }
+        }
+        return true;
+    }
+
     static inline bool isSkyTexture(const char* name)
     {
         return !std::strncmp(name, "sky", 3);
@@ -250,26 +317,527 @@ namespace {
 
     static bool isRenderable(const BspEntity& entity)
     {
-        const auto& classname = entity.getProperty(BspEntity::Property::KEY_CLASSNAME).value;
-        return !std::strncmp(classname.data(), "func_", 5);
+        return entity.getProperty(BspEntity::Property::KEY_CLASSNAME).value.startsWith("func_");
+    }
+
+    struct Chunk
+    {
+        int first;
+        int count;
+        int slot;
+    };
+
+    template<typename T, typename Create>
+    struct ChunkContext
+    {
+        const Create& create;
+        std::vector<std::vector<T>>* results;
+
+        void process(const Chunk& chunk) const
+        {
+            std::vector<T>& result = (*results)[chunk.slot];
+            result.reserve(chunk.count);
+            for (int ii = chunk.first; ii < chunk.first + chunk.count; ++ii)
+            {
+                result.push_back(create(ii));
+            }
+        }
+    };
+
+    // Appends create(0) ... create(count - 1) to output, chunks are built in parallel but joined in order
+    template<typename T, typename Create>
+    void createInChunks(Scheduler* scheduler, int count, const Create& create, std::vector<T>* output)
+    {
+        output->reserve(output->size() + count);
+        if (!scheduler || count < MIN_CHUNK_SIZE * 2)
+        {
+            for (int ii = 0; ii < count; ++ii)
+            {
+                output->push_back(create(ii));
+            }
+            return;
+        }
+
+        const int chunkSize = math::max(MIN_CHUNK_SIZE, count / (scheduler->getWorkerCount() * CHUNKS_PER_THREAD));
+        std::vector<Chunk> chunks;
+        for (int first = 0; first < count; first += chunkSize)
+        {
+            chunks.push_back({first, math::min(chunkSize, count - first), static_cast<int>(chunks.size())});
+        }
+
+        std::vector<std::vector<T>> results(chunks.size());
+        const ChunkContext<T, Create> context = {create, &results};
+        scheduler->schedule(chunks, context);
+        for (auto& result : results)
+        {
+            output->insert(output->end(), std::make_move_iterator(result.begin()), std::make_move_iterator(result.end()));
+        }
+    }
+
+    struct FacePolygon
+    {
+        std::vector<math::Vec3f> vertices;
+        math::Vec3f normal;
+        int plane;
+        int side;
+        int texinfo;
+    };
+
+    inline bool isExtendedFormat(int32_t version)
+    {
+        return version == BSP2_VERSION || version == BSP2_RMQ_VERSION;
+    }
+
+    // Views on the lumps that describe face geometry, for either face and edge layout
+    template<typename FaceType, typename EdgeType>
+    struct FaceLumps
+    {
+        util::ArrayView<Plane> planes;
+        util::ArrayView<FaceType> faces;
+        util::ArrayView<Vertex> vertices;
+        util::ArrayView<EdgeType> edges;
+        util::ArrayView<int32_t> edgeIndices;
+
+        static const FaceLumps create(const void* data, const Header& header)
+        {
+            return {
+                entry2view<Plane>(data, header.lumps[LUMP_PLANES]),
+                entry2view<FaceType>(data, header.lumps[LUMP_FACES]),
+                entry2view<Vertex>(data, header.lumps[LUMP_VERTEXES]),
+                entry2view<EdgeType>(data, header.lumps[LUMP_EDGES]),
+                entry2view<int32_t>(data, header.lumps[LUMP_SURFEDGES]),
+            };
+        }
+
+        int getVertexIndex(const FaceType& f, int edge) const
+        {
+            const int edgeLookup = edgeIndices[f.ledge_id + edge];
+            ASSERT(edgeLookup != 0);
+            const EdgeType& e = edges[std::abs(edgeLookup)];
+            return static_cast<int>(edgeLookup > 0 ? e.vertex_idx_start : e.vertex_idx_end);
+        }
+
+        const FacePolygon createFace(int idx) const
+        {
+            const FaceType& f = faces[idx];
+            FacePolygon face;
+            face.vertices.resize(f.ledge_num);
+            for (int jj = 0; jj < f.ledge_num; ++jj)
+            {
+                face.vertices[jj] = vert2vec3(vertices[getVertexIndex(f, jj)]);
+            }
+            const Plane& plane = planes[f.plane_id];
+            face.normal = norm2vec3(plane.normal) * static_cast<float>(1 - f.side * 2);
+            face.plane = f.plane_id;
+            face.side = f.side;
+            face.texinfo = f.texinfo_id;
+            return face;
+        }
+
+        void printAsObj(const Model& model) const
+        {
+            for (int ii = 0; ii < vertices.size; ++ii)
+            {
+                const auto a = vert2vec3(vertices[ii]);
+                printf("v %.01f %.01f %.01f\n", a.x, a.y, a.z);
+            }
+
+            for (int ii = 0; ii < model.face_num; ++ii)
+            {
+                const FaceType& f = faces[model.face_id + ii];
+                printf("f");
+                for (int jj = 0; jj < f.ledge_num; ++jj)
+                {
+                    printf(" %d", getVertexIndex(f, jj) + 1);
+                }
+                printf("\n");
+            }
+        }
+    };
+
+    typedef FaceLumps<Face, Edge> Bsp29FaceLumps;
+    typedef FaceLumps<Face2, Edge2> Bsp2FaceLumps;
+
+    // Reads the face and edge lumps in the layout of the file version only, the other layout would misread them
+    template<typename Lumps>
+    std::function<const FacePolygon(int)> createFaceReader(const void* data, const Header& header)
+    {
+        const Lumps lumps = Lumps::create(data, header);
+        return [lumps](int faceIdx) { return lumps.createFace(faceIdx); };
+    }
+
+    inline bool isSameVertex(const math::Vec3f& a, const math::Vec3f& b)
+    {
+        return math::distance2(a, b) < math::squared(MERGE_VERTEX_EPSILON);
+    }
+
+    inline float calcTurn(const math::Vec3f& prev, const math::Vec3f& vertex, const math::Vec3f& next, const math::Vec3f& normal)
+    {
+        const auto edgeIn = math::normalized(vertex - prev);
+        const auto edgeOut = math::normalized(next - vertex);
+        return math::dot(math::cross(edgeIn, edgeOut), normal);
+    }
+
+    // Drops vertices lying on the line between their neighbours
+    void removeCollinearVertices(std::vector<math::Vec3f>* vertices, const math::Vec3f& normal)
+    {
+        for (int ii = util::lastIndex(*vertices); ii >= 0 && vertices->size() > 2; --ii)
+        {
+            const int count = static_cast<int>(vertices->size());
+            const auto& prev = (*vertices)[(ii + count - 1) % count];
+            const auto& next = (*vertices)[(ii + 1) % count];
+            const auto& vertex = (*vertices)[ii];
+            if (isSameVertex(prev, vertex) || std::abs(calcTurn(prev, vertex, next, normal)) < MERGE_COLLINEAR_EPSILON)
+            {
+                vertices->erase(vertices->begin() + ii);
+                ii = math::min(ii, util::lastIndex(*vertices));
+            }
+        }
+    }
+
+    // Collinear vertices are accepted, they keep shared edges intact for merging with further neighbours
+    bool isConvex(const std::vector<math::Vec3f>& vertices, const math::Vec3f& normal)
+    {
+        const int count = static_cast<int>(vertices.size());
+        float winding = 0.0f;
+        for (int ii = 0; ii < count; ++ii)
+        {
+            const float turn = calcTurn(vertices[(ii + count - 1) % count], vertices[ii], vertices[(ii + 1) % count], normal);
+            if (std::abs(turn) < MERGE_COLLINEAR_EPSILON) { continue; }
+            if (winding == 0.0f) { winding = math::sign(turn); }
+            if (turn * winding < 0.0f) { return false; }
+        }
+        return winding != 0.0f;
+    }
+
+    float calcArea(const std::vector<math::Vec3f>& vertices, const math::Vec3f& normal)
+    {
+        math::Vec3f sum;
+        for (int ii = util::lastIndex(vertices); ii >= 0; --ii)
+        {
+            sum += math::cross(vertices[ii], vertices[(ii + 1) % vertices.size()]);
+        }
+        return std::abs(math::dot(sum, normal)) * 0.5f;
+    }
+
+    // Joins two polygons sharing an edge, fails when they do not share one or the result would be concave
+    bool tryMergePolygons(const FacePolygon& a, const FacePolygon& b, std::vector<math::Vec3f>* merged)
+    {
+        const int countA = static_cast<int>(a.vertices.size());
+        const int countB = static_cast<int>(b.vertices.size());
+        for (int ii = 0; ii < countA; ++ii)
+        {
+            const auto& edgeStart = a.vertices[ii];
+            const auto& edgeEnd = a.vertices[(ii + 1) % countA];
+            for (int jj = 0; jj < countB; ++jj)
+            {
+                // Neighbouring faces run along the shared edge in opposite directions
+                if (!isSameVertex(b.vertices[jj], edgeEnd) || !isSameVertex(b.vertices[(jj + 1) % countB], edgeStart))
+                {
+                    continue;
+                }
+
+                // Earlier merges leave collinear vertices behind, so the shared border can span several edges
+                int shared = 1;
+                int startA = ii;
+                int endB = (jj + 1) % countB;
+                while (shared < countA - 1 && shared < countB - 1
+                       && isSameVertex(a.vertices[(startA + countA - 1) % countA], b.vertices[(endB + 1) % countB]))
+                {
+                    startA = (startA + countA - 1) % countA;
+                    endB = (endB + 1) % countB;
+                    ++shared;
+                }
+                int endA = (ii + 1) % countA;
+                int startB = jj;
+                while (shared < countA - 1 && shared < countB - 1
+                       && isSameVertex(a.vertices[(endA + 1) % countA], b.vertices[(startB + countB - 1) % countB]))
+                {
+                    endA = (endA + 1) % countA;
+                    startB = (startB + countB - 1) % countB;
+                    ++shared;
+                }
+
+                merged->clear();
+                for (int kk = 0; kk <= countA - shared; ++kk)
+                {
+                    merged->push_back(a.vertices[(endA + kk) % countA]);
+                }
+                for (int kk = 1; kk < countB - shared; ++kk)
+                {
+                    merged->push_back(b.vertices[(endB + kk) % countB]);
+                }
+                return isConvex(*merged, a.normal);
+            }
+        }
+        return false;
+    }
+
+    inline bool overlaps(const math::BoundingBox& a, const math::BoundingBox& b)
+    {
+        const float e = MERGE_VERTEX_EPSILON;
+        return a.min.x <= b.max.x + e && b.min.x <= a.max.x + e
+            && a.min.y <= b.max.y + e && b.min.y <= a.max.y + e
+            && a.min.z <= b.max.z + e && b.min.z <= a.max.z + e;
+    }
+
+    // qbsp splits faces on BSP planes and lightmap extents, glue the pieces back together where they stay convex
+    void mergeCoplanarFaces(std::vector<FacePolygon>* faces)
+    {
+        std::sort(faces->begin(), faces->end(), [](const FacePolygon& a, const FacePolygon& b)
+        {
+            if (a.plane != b.plane) { return a.plane < b.plane; }
+            if (a.side != b.side) { return a.side < b.side; }
+            return a.texinfo < b.texinfo;
+        });
+
+        std::vector<FacePolygon> result;
+        std::vector<math::BoundingBox> bounds;
+        std::vector<math::Vec3f> merged;
+        for (int groupStart = 0; groupStart < static_cast<int>(faces->size());)
+        {
+            const FacePolygon& first = (*faces)[groupStart];
+            int groupEnd = groupStart + 1;
+            while (groupEnd < static_cast<int>(faces->size())
+                   && (*faces)[groupEnd].plane == first.plane
+                   && (*faces)[groupEnd].side == first.side
+                   && (*faces)[groupEnd].texinfo == first.texinfo)
+            {
+                ++groupEnd;
+            }
+
+            std::vector<FacePolygon> group(faces->begin() + groupStart, faces->begin() + groupEnd);
+            bounds.resize(group.size());
+            for (int ii = util::lastIndex(group); ii >= 0; --ii)
+            {
+                bounds[ii] = math::BoundingBox::createEmpty();
+                for (const auto& vertex : group[ii].vertices) { bounds[ii].add(vertex); }
+            }
+
+            // Polygons grown later may fit onto earlier ones, so repeat until a pass joins nothing
+            bool changed = true;
+            while (changed)
+            {
+                changed = false;
+                for (int ii = 0; ii < static_cast<int>(group.size()); ++ii)
+                {
+                    for (int jj = ii + 1; jj < static_cast<int>(group.size()); ++jj)
+                    {
+                        if (!overlaps(bounds[ii], bounds[jj]) || !tryMergePolygons(group[ii], group[jj], &merged))
+                        {
+                            continue;
+                        }
+                        group[ii].vertices = merged;
+                        bounds[ii].add(bounds[jj]);
+                        group.erase(group.begin() + jj);
+                        bounds.erase(bounds.begin() + jj);
+                        jj = ii;
+                        changed = true;
+                    }
+                }
+            }
+
+            for (int ii = 0; ii < static_cast<int>(group.size()); ++ii)
+            {
+                // Slivers left over by the BSP compiler are invisible, but still cost a test for every ray
+                removeCollinearVertices(&group[ii].vertices, group[ii].normal);
+                if (group[ii].vertices.size() > 2 && calcArea(group[ii].vertices, group[ii].normal) >= MIN_POLYGON_AREA)
+                {
+                    result.push_back(group[ii]);
+                }
+            }
+            groupStart = groupEnd;
+        }
+
+        faces->swap(result);
+    }
+}
+
+bool BspLoader::isValidHeader(const void* data, size_t size)
+{
+    if (size < sizeof(Header)) { return false; }
+    auto& header = *util::castFromMemory<Header>(data);
+    if (header.version != BSP_VERSION && !isExtendedFormat(header.version)) { return false; }
+
+    // Every lump view taken by the loader must stay inside the file
+    for (int ii = 0; ii < NUM_LUMPS; ++ii)
+    {
+        const Entry& entry = header.lumps[ii];
+        if (!isRangeInside(entry.offset, entry.size, size)) { return false; }
+    }
+    return true;
+}
+
+bool BspLoader::isValidBsp(const void* data, size_t size)
+{
+    if (!isValidHeader(data, size)) { return false; }
+
+    auto& header = *util::castFromMemory<Header>(data);
+    const int textureInfoCount = header.lumps[LUMP_TEXINFO].size / sizeof(TextureInfo);
+    if (!isValidTextureLump(data, header.lumps[LUMP_TEXTURES], textureInfoCount)) { return false; }
+    if (textureInfoCount > 0)
+    {
+        const int32_t textureCount = *util::castFromMemory<int32_t>(data, header.lumps[LUMP_TEXTURES].offset);
+        auto textureInfo = entry2view<TextureInfo>(data, header.lumps[LUMP_TEXINFO]);
+        for (int ii = textureInfo.size - 1; ii >= 0; --ii)
+        {
+            if (textureInfo[ii].texture_id >= static_cast<uint32_t>(textureCount)) { return false; }
+        }
+    }
+    return true;
+}
+
+const BspLoader::Info BspLoader::readInfo(const void* data, size_t size)
+{
+    ASSERT(isValidHeader(data, size));
+
+    Info info;
+    auto& header = *util::castFromMemory<Header>(data);
+    info.faceCount = header.lumps[LUMP_FACES].size / (isExtendedFormat(header.version) ? sizeof(Face2) : sizeof(Face));
+    info.modelCount = header.lumps[LUMP_MODELS].size / sizeof(Model);
+    if (header.lumps[LUMP_TEXTURES].size >= static_cast<int32_t>(sizeof(int32_t)))
+    {
+        info.textureCount = *util::castFromMemory<int32_t>(data, header.lumps[LUMP_TEXTURES].offset);
+    }
+    if (info.modelCount > 0)
+    {
+        info.bounds = bound2box(util::castFromMemory<Model>(data, header.lumps[LUMP_MODELS].offset)->bound);
+    }
+
+    auto entitiesEntry = entry2view<char>(data, header.lumps[LUMP_ENTITIES]);
+    auto entities = BspEntity::parseList({entitiesEntry.array, entitiesEntry.size});
+
+    // Mirrors the entity pass of createSceneFromBsp, without building anything
+    Info::Camera startCamera{{0.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 0.0f}};
+    std::unordered_set<std::string> targetNames;
+    std::vector<const BspEntity*> targetedLights;
+    for (int ii = 0; ii < static_cast<int>(entities.size()); ++ii)
+    {
+        const BspEntity& entity = entities[ii];
+        switch (entity.type)
+        {
+            case BspEntity::TYPE_PLAYER_START:
+                startCamera.origin = parsePlayerStart(entity).origin;
+                startCamera.angles = {0.0f, entity.getProperty(BspEntity::Property::KEY_ANGLE).number, 0.0f};
+                break;
+            case BspEntity::TYPE_INTERMISSION_CAMERA:
+                info.cameras.push_back({entity.getProperty(BspEntity::Property::KEY_ORIGIN).vec, entity.getProperty(BspEntity::Property::KEY_MANGLE).vec});
+                break;
+            case BspEntity::TYPE_LIGHT:
+                if (entity.hasProperty(BspEntity::Property::KEY_TARGET))
+                {
+                    targetedLights.push_back(&entity);
+                }
+                else
+                {
+                    ++info.pointLightCount;
+                }
+                break;
+            default:
+                break;
+        }
+
+        if (entity.hasProperty(BspEntity::Property::KEY_TARGETNAME) && entity.hasProperty(BspEntity::Property::KEY_ORIGIN))
+        {
+            targetNames.insert(entity.getProperty(BspEntity::Property::KEY_TARGETNAME).value.toString());
+        }
+    }
+
+    for (int ii = util::lastIndex(targetedLights); ii >= 0; --ii)
+    {
+        const auto target = targetedLights[ii]->getProperty(BspEntity::Property::KEY_TARGET).value.toString();
+        if (targetNames.count(target))
+        {
+            ++info.spotLightCount;
+        }
+        else
+        {
+            ++info.pointLightCount;
+        }
     }
+
+    if (info.cameras.empty())
+    {
+        info.cameras.push_back(startCamera);
+    }
+
+    return info;
 }
 
-const Scene BspLoader::createSceneFromBsp(const void* data, int size)
+const CameraPath BspLoader::readCameraPath(const void* data, size_t size, float speed)
+{
+    ASSERT(isValidHeader(data, size));
+    auto& header = *util::castFromMemory<Header>(data);
+    auto entitiesEntry = entry2view<char>(data, header.lumps[LUMP_ENTITIES]);
+    auto entities = BspEntity::parseList({entitiesEntry.array, entitiesEntry.size});
+
+    std::vector<const BspEntity*> corners;
+    std::unordered_map<std::string, int> cornersByName;
+    std::unordered_set<std::string> targetedNames;
+    for (int ii = 0; ii < static_cast<int>(entities.size()); ++ii)
+    {
+        const BspEntity& entity = entities[ii];
+        if (entity.type != BspEntity::TYPE_PATH_CORNER)
+        {
+            continue;
+        }
+
+        if (entity.hasProperty(BspEntity::Property::KEY_TARGETNAME))
+        {
+            cornersByName.emplace(entity.getProperty(BspEntity::Property::KEY_TARGETNAME).value.toString(), static_cast<int>(corners.size()));
+        }
+        if (entity.hasProperty(BspEntity::Property::KEY_TARGET))
+        {
+            targetedNames.insert(entity.getProperty(BspEntity::Property::KEY_TARGET).value.toString());
+        }
+        corners.push_back(&entity);
+    }
+
+    int start = corners.empty() ? -1 : 0;
+    for (int ii = util::lastIndex(corners); ii >= 0; --ii)
+    {
+        if (!targetedNames.count(corners[ii]->getProperty(BspEntity::Property::KEY_TARGETNAME).value.toString()))
+        {
+            start = ii;
+        }
+    }
+
+    std::vector<math::Vec3f> points;
+    std::vector<bool> visited(corners.size(), false);
+    for (int ii = start; ii >= 0; )
+    {
+        points.push_back(corners[ii]->getProperty(BspEntity::Property::KEY_ORIGIN).vec);
+        if (visited[ii])
+        {
+            break;
+        }
+        visited[ii] = true;
+
+        const auto next = cornersByName.find(corners[ii]->getProperty(BspEntity::Property::KEY_TARGET).value.toString());
+        ii = next != cornersByName.end() ? next->second : -1;
+    }
+    return CameraPath::createFromPoints(points, speed);
+}
+
+const Scene BspLoader::createSceneFromBsp(const void* data, int size, const Options& options)
 {
 #if BSP2OBJ_DEBUG
     printBspAsObj(data, size);
 #endif
 
     Scene scene;
+    std::unique_ptr<Scheduler> ownScheduler;
+    if (!options.scheduler && options.threads > 1)
+    {
+        ownScheduler.reset(new Scheduler(options.threads));
+    }
+    Scheduler* scheduler = options.scheduler ? options.scheduler : ownScheduler.get();
 
     auto& header = *util::castFromMemory<Header>(data);
-    auto planes = entry2view<Plane>(data, header.lumps[LUMP_PLANES]);
-    auto faces = entry2view<Face>(data, header.lumps[LUMP_FACES]);
-    auto vertices = entry2view<Vertex>(data, header.lumps[LUMP_VERTEXES]);
-    auto edges = entry2view<Edge>(data, header.lumps[LUMP_EDGES]);
+    const auto readFace = isExtendedFormat(header.version)
+        ? createFaceReader<Bsp2FaceLumps>(data, header)
+        : createFaceReader<Bsp29FaceLumps>(data, header);
     auto models = entry2view<Model>(data, header.lumps[LUMP_MODELS]);
-    auto edgeIndices = entry2view<int32_t>(data, header.lumps[LUMP_SURFEDGES]);
     auto textureInfo = entry2view<TextureInfo>(data, header.lumps[LUMP_TEXINFO]);
     auto entitiesEntry = entry2view<char>(data, header.lumps[LUMP_ENTITIES]);
     auto entities = BspEntity::parseList({entitiesEntry.array, entitiesEntry.size});
@@ -320,7 +888,7 @@ const Scene BspLoader::createSceneFromBsp(const void* data, int size)
 
         if (entity.hasProperty(BspEntity::Property::KEY_TARGETNAME) && entity.hasProperty(BspEntity::Property::KEY_ORIGIN))
         {
-            auto name = entity.getProperty(BspEntity::Property::KEY_TARGETNAME).value;
+            auto name = entity.getProperty(BspEntity::Property::KEY_TARGETNAME).value.toString();
             auto origin = entity.getProperty(BspEntity::Property::KEY_ORIGIN).vec;
             targetPositions.emplace(name, origin);
         }
@@ -329,7 +897,7 @@ const Scene BspLoader::createSceneFromBsp(const void* data, int size)
     for (int ii = util::lastIndex(spotLights); ii >= 0; --ii)
     {
         const BspEntity& entity = *spotLights[ii];
-        auto target = entity.getProperty(BspEntity::Property::KEY_TARGET).value;
+        auto target = entity.getProperty(BspEntity::Property::KEY_TARGET).value.toString();
         if (targetPositions.count(target))
         {
             auto origin = targetPositions[target];
@@ -350,75 +918,108 @@ const Scene BspLoader::createSceneFromBsp(const void* data, int size)
         cameras.push_back(startCamera);
     }
 
-    const void* palette = AssetHelper::getRaw(AssetHelper::PALETTE, nullptr);
+    const void* palette = options.palette ? options.palette : AssetHelper::getRaw(AssetHelper::PALETTE, nullptr);
     const int32_t* textureOffsets = util::castFromMemory<int32_t>(data, header.lumps[LUMP_TEXTURES].offset);
     int textureCount = textureOffsets[0];
-    scene.textures.reserve(textureCount);
-    auto dummyTexture = Texture::createCheckerBoard(64, 64, 16, Color(1.0f, 0.0f, 1.0f), Color(0.0f, 0.0f, 1.0f));
-    std::vector<bool> dummyTextureFullbright(dummyTexture.getWidth() * dummyTexture.getHeight(), true);
-    std::vector<const MipsTexture*> mipTextures;
+    std::vector<const MipsTexture*> mipTextures(textureCount, nullptr);
     for (int ii = 1; ii <= textureCount; ++ii)
     {
-        if (textureOffsets[ii] == -1)
+        if (textureOffsets[ii] != -1)
+        {
+            mipTextures[ii - 1] = util::castFromMemory<MipsTexture>(data, header.lumps[LUMP_TEXTURES].offset + textureOffsets[ii]);
+        }
+    }
+
+    // Missing textures get a checkerboard drawn from two fullbright entries of a palette of their own
+    scene.palettes.push_back(Palette::createFromRGB(palette));
+    Palette dummyPalette = scene.palettes[LEVEL_PALETTE];
+    dummyPalette.colors[Palette::FIRST_FULLBRIGHT] = Color(1.0f, 0.0f, 1.0f);
+    dummyPalette.colors[Palette::FIRST_FULLBRIGHT + 1] = Color(0.0f, 0.0f, 1.0f);
+    scene.palettes.push_back(dummyPalette);
+    const Scene::TextureData dummyTexture = {
+        IndexedTexture::createCheckerBoard(64, 64, 16, Palette::FIRST_FULLBRIGHT, Palette::FIRST_FULLBRIGHT + 1),
+        DUMMY_PALETTE
+    };
+    auto copyTexture = [&](int idx) -> Scene::TextureData
+    {
+        const MipsTexture* def = mipTextures[idx];
+        if (!def)
         {
             // Texture not found
-            scene.textures.push_back({dummyTexture, dummyTextureFullbright});
-            mipTextures.push_back(nullptr);
-            continue;
+            return dummyTexture;
         }
-        int offset = header.lumps[LUMP_TEXTURES].offset + textureOffsets[ii];
-        auto def = util::castFromMemory<MipsTexture>(data, offset);
-        auto indices = util::castFromMemory<uint8_t>(data, offset + def->offset[MipsTexture::MIP_1X1]);
-        std::vector<bool> fullbright(def->width * def->height);
-        for (int ii = util::lastIndex(fullbright); ii >= 0; --ii)
+        const void* mips[MipsTexture::NUM_MIPS];
+        for (int mip = 0; mip < MipsTexture::NUM_MIPS; ++mip)
         {
-            fullbright[ii] = isFullBright(indices[ii]);
+            mips[mip] = util::castFromMemory<uint8_t>(def, def->offset[mip]);
         }
-        scene.textures.push_back({Texture::createFromIndexedRGB(def->width, def->height, indices, palette), fullbright});
-        mipTextures.push_back(def);
+        const int levelCount = math::min<int>(MipsTexture::NUM_MIPS, IndexedTexture::calcLevelCount(def->width, def->height));
+        return {IndexedTexture::createFromMips(def->width, def->height, mips, levelCount), LEVEL_PALETTE};
+    };
+    createInChunks(scheduler, textureCount, copyTexture, &scene.textures);
+
+    // Faces share a few hundred texture infos, so materials are stored once per texture info
+    scene.materials.reserve(textureInfo.size);
+    for (int ii = 0; ii < textureInfo.size; ++ii)
+    {
+        const auto& texture = textureInfo[ii];
+#if COLOR_DEBUG
+        auto mat = info2material(texture, DISTINCT_COLORS[ii % DISTINCT_COLOR_COUNT]);
+#else
+        auto mat = info2material(texture, Color(0.0f, 0.0f, 0.0f));
+#endif
+        auto mipTexture = mipTextures[texture.texture_id];
+        mat.flags[Scene::Material::FLAG_SKYSHADER] = mipTexture && isSkyTexture(mipTexture->name);
+        scene.materials.push_back(mat);
     }
 
+    // Every BSP model gets its own acceleration structure, entities referencing it become instances
+    std::vector<int> sceneModels(models.size, -1);
+    std::vector<FacePolygon> modelFaces;
+    std::vector<Scene::ConvexPolygon> modelPolygons;
+    int faceCount = 0;
     for (int ii = util::lastIndex(modelIndices); ii >= 0; --ii)
     {
         const int modelIdx = modelIndices[ii];
+        if (sceneModels[modelIdx] > -1)
+        {
+            scene.addInstance(sceneModels[modelIdx], {0, 0, 0});
+            continue;
+        }
+
         const Model& model = models[modelIdx];
+        auto createFace = [&](int idx) { return readFace(model.face_id + idx); };
+        modelFaces.clear();
+        createInChunks(scheduler, model.face_num, createFace, &modelFaces);
+        faceCount += model.face_num;
 
-        for (int ii = 0; ii < model.face_num; ++ii)
+        if (options.mergeFaces)
         {
-            const int faceIdx = model.face_id + ii;
-            const Face& f = faces[faceIdx];
-            std::vector<math::Vec3f> polyVertices(f.ledge_num);
-            for (int jj = 0; jj < f.ledge_num; ++jj)
-            {
-                const int edgeLookup = edgeIndices[f.ledge_id + jj];
-                ASSERT(edgeLookup != 0);
-                const Edge& e = edges[std::abs(edgeLookup)];
+            mergeCoplanarFaces(&modelFaces);
+        }
 
-                int idxStart = edgeLookup > 0 ? e.vertex_idx_start : e.vertex_idx_end;
-                polyVertices[jj] = vert2vec3(vertices[idxStart]);
-            }
-            const Plane& plane = planes[f.plane_id];
-            const auto normal = norm2vec3(plane.normal) * static_cast<float>(1 - f.side * 2);
-            const auto& texture = textureInfo[f.texinfo_id];
-#if COLOR_DEBUG
-            auto mat = info2material(texture, DISTINCT_COLORS[ii % DISTINCT_COLOR_COUNT]);
-#else
-            auto mat = info2material(texture, Color(0.0f, 0.0f, 0.0f));
-#endif
-            bool skyTexture = false;
-            bool waterTexture = false;
-            auto mipTexture = mipTextures[texture.texture_id];
-            if (mipTexture)
-            {
-                skyTexture = isSkyTexture(mipTexture->name);
-                waterTexture = isWaterTexture(mipTexture->name);
-            }
+        auto createPolygon = [&](int idx)
+        {
+            const FacePolygon& face = modelFaces[idx];
+            const auto mipTexture = mipTextures[textureInfo[face.texinfo].texture_id];
+            const bool waterTexture = mipTexture && isWaterTexture(mipTexture->name);
 
-            mat.flags[Scene::Material::FLAG_SKYSHADER] = skyTexture;
-            auto poly = Scene::ConvexPolygon::create(polyVertices, normal, mat);
+            auto poly = Scene::ConvexPolygon::create(face.vertices, face.normal, face.texinfo);
             poly.flags[Scene::ConvexPolygon::FLAG_SHADOWCAST] = !waterTexture;
-            scene.polygons.push_back(poly);
-        }
+            return poly;
+        };
+        modelPolygons.clear();
+        createInChunks(scheduler, static_cast<int>(modelFaces.size()), createPolygon, &modelPolygons);
+
+        sceneModels[modelIdx] = scene.addModel(modelPolygons, bound2box(model.bound));
+        scene.models[sceneModels[modelIdx]].levelModel = modelIdx;
+        scene.addInstance(sceneModels[modelIdx], {0, 0, 0});
+    }
+    scene.buildInstanceBvh();
+
+    if (options.mergeFaces)
+    {
+        LOG("Merged %d faces into %d polygons\n", faceCount, static_cast<int>(scene.polygons.size()));
     }
 
     const float fov = 60;
@@ -476,35 +1077,15 @@ const BspLoader::CameraDefinition BspLoader::parsePlayerStart(const BspEntity& e
 void BspLoader::printBspAsObj(const void* data, int size)
 {
     auto& header = *util::castFromMemory<Header>(data);
-    auto faces = entry2view<Face>(data, header.lumps[LUMP_FACES]);
-    auto vertices = entry2view<Vertex>(data, header.lumps[LUMP_VERTEXES]);
-    auto edges = entry2view<Edge>(data, header.lumps[LUMP_EDGES]);
     auto models = entry2view<Model>(data, header.lumps[LUMP_MODELS]);
-    auto edgeIndices = entry2view<int32_t>(data, header.lumps[LUMP_SURFEDGES]);
-
     const Model& base = models[0];
-
-    for (int ii = 0; ii < vertices.size; ++ii)
+    if (isExtendedFormat(header.version))
     {
-        const auto a = vert2vec3(vertices[ii]);
-        printf("v %.01f %.01f %.01f\n", a.x, a.y, a.z);
+        Bsp2FaceLumps::create(data, header).printAsObj(base);
     }
-
-    for (int ii = 0; ii < base.face_num; ++ii)
+    else
     {
-        const int faceIdx = base.face_id + ii;
-        const Face& f = faces[faceIdx];
-        printf("f");
-        for (int jj = 0; jj < f.ledge_num; ++jj)
-        {
-            const int edgeLookup = edgeIndices[f.ledge_id + jj];
-            ASSERT(edgeLookup != 0);
-            const Edge& e = edges[std::abs(edgeLookup)];
-
-            int idxStart = edgeLookup > 0 ? e.vertex_idx_start : e.vertex_idx_end;
-            printf(" %d", idxStart + 1);
-        }
-        printf("\n");
+        Bsp29FaceLumps::create(data, header).printAsObj(base);
     }
 }
 
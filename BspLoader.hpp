@@ -3,8 +3,13 @@
 #include "Scene.hpp"
 #include "Vec3.hpp"
 #include "Lighting.hpp"
+#include "CameraPath.hpp"
+#include "BoundingBox.hpp"
+#include <vector>
+#include <cstddef>
 
 struct BspEntity;
+class Scheduler;
 
 struct BspLoader
 {
@@ -14,7 +19,43 @@ struct BspLoader
         math::Vec3f direction;
     };
 
-    static const Scene createSceneFromBsp(const void* data, int size);
+    struct Options
+    {
+        Options() : mergeFaces(false), threads(1), palette(nullptr), scheduler(nullptr) {}
+
+        bool mergeFaces;    // Merge adjacent coplanar faces sharing a texture into larger polygons
+        int threads;        // Worker threads for texture decoding and polygon construction, does not affect the result
+        const void* palette; // 256 RGB entries to decode textures with, the bundled Quake palette when null
+        Scheduler* scheduler; // Shared workers to use instead of starting threads for this load only
+    };
+
+    // Level summary that only needs the header and the entity lump
+    struct Info
+    {
+        struct Camera
+        {
+            math::Vec3f origin;
+            math::Vec3f angles; // Pitch, yaw and roll in degrees
+        };
+
+        Info() : pointLightCount(0), spotLightCount(0), faceCount(0), textureCount(0), modelCount(0), bounds(math::BoundingBox::createEmpty()) {}
+
+        std::vector<Camera> cameras; // Same order and fallback as the cameras of a loaded scene
+        int pointLightCount;
+        int spotLightCount;
+        int faceCount;
+        int textureCount;
+        int modelCount;
+        math::BoundingBox bounds;    // Bounds of the world model
+    };
+
+    static bool isValidBsp(const void* data, size_t size);
+    // Only checks the version and that every lump lies inside the file, enough for readInfo and readCameraPath
+    static bool isValidHeader(const void* data, size_t size);
+    static const Info readInfo(const void* data, size_t size);
+    // Follows the chain of path_corner entities from the first one no other corner targets, a looping chain ends where it closes
+    static const CameraPath readCameraPath(const void* data, size_t size, float speed);
+    static const Scene createSceneFromBsp(const void* data, int size, const Options& options = Options());
     static const CameraDefinition parseIntermissionCamera(const BspEntity& entity);
     static const CameraDefinition parsePlayerStart(const BspEntity& entity);
     static const Lighting::Point parsePointLight(const BspEntity& entity);
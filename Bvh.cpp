@@ -0,0 +1,204 @@
+#include "Bvh.hpp"
+#include "Math.hpp"
+#include "Util.hpp"
+#include <algorithm>
+
+namespace {
+    static const int BIN_COUNT = 12;
+    static const int MAX_LEAF_SIZE = 8;
+    // Past this depth nodes are only split at the median, which halves them and reaches the leaves within 31 more levels
+    static const int MAX_HEURISTIC_DEPTH = Bvh::MAX_DEPTH / 2;
+
+    inline float getAxis(const math::Vec3f& v, int axis)
+    {
+        return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+    }
+
+    struct Bin
+    {
+        math::BoundingBox bounds;
+        int count;
+    };
+
+    // Turns a node into an inner node whose left child takes its first leftCount primitives
+    bool addChildren(Bvh* bvh, int nodeIdx, int leftCount, const std::vector<math::BoundingBox>& primitives)
+    {
+        const Bvh::Node node = bvh->nodes[nodeIdx];
+        const int childIdx = static_cast<int>(bvh->nodes.size());
+        bvh->nodes.push_back({math::BoundingBox::createEmpty(), node.first, leftCount});
+        bvh->nodes.push_back({math::BoundingBox::createEmpty(), node.first + leftCount, node.count - leftCount});
+        for (int child = childIdx; child <= childIdx + 1; ++child)
+        {
+            Bvh::Node& childNode = bvh->nodes[child];
+            for (int ii = childNode.first + childNode.count - 1; ii >= childNode.first; --ii)
+            {
+                childNode.bounds.add(primitives[bvh->indices[ii]]);
+            }
+        }
+
+        bvh->nodes[nodeIdx].first = childIdx;
+        bvh->nodes[nodeIdx].count = 0;
+        bvh->parents.push_back(nodeIdx);
+        bvh->parents.push_back(nodeIdx);
+        return true;
+    }
+
+    struct BuildEntry
+    {
+        int node;
+        int depth;
+    };
+
+    // Split a node using the surface area heuristic, returns false when the node should stay a leaf.
+    // The heuristic can split off one primitive at a time, below MAX_HEURISTIC_DEPTH only median splits bound the depth.
+    bool splitNode(Bvh* bvh, int nodeIdx, int depth, const std::vector<math::BoundingBox>& primitives, const std::vector<math::Vec3f>& centers)
+    {
+        const Bvh::Node node = bvh->nodes[nodeIdx];
+        const bool useHeuristic = depth < MAX_HEURISTIC_DEPTH;
+        if (node.count <= 1 || (!useHeuristic && node.count <= MAX_LEAF_SIZE)) { return false; }
+
+        math::BoundingBox centerBounds = math::BoundingBox::createEmpty();
+        for (int ii = node.first + node.count - 1; ii >= node.first; --ii)
+        {
+            centerBounds.add(centers[bvh->indices[ii]]);
+        }
+
+        const auto extent = centerBounds.max - centerBounds.min;
+        int axis = 0;
+        if (extent.y > extent.x) { axis = 1; }
+        if (extent.z > getAxis(extent, axis)) { axis = 2; }
+        const float axisMin = getAxis(centerBounds.min, axis);
+        const float axisExtent = getAxis(extent, axis);
+        if (axisExtent <= math::APPROXIMATE_ZERO)
+        {
+            // All centers coincide, nothing sensible to split on
+            return false;
+        }
+
+        if (!useHeuristic)
+        {
+            int* begin = bvh->indices.data() + node.first;
+            std::nth_element(begin, begin + node.count / 2, begin + node.count, [&](int a, int b) { return getAxis(centers[a], axis) < getAxis(centers[b], axis); });
+            return addChildren(bvh, nodeIdx, node.count / 2, primitives);
+        }
+
+        auto binOf = [&](int primitive)
+        {
+            int bin = static_cast<int>((getAxis(centers[primitive], axis) - axisMin) / axisExtent * BIN_COUNT);
+            return math::min(bin, BIN_COUNT - 1);
+        };
+
+        Bin bins[BIN_COUNT];
+        for (int ii = 0; ii < BIN_COUNT; ++ii)
+        {
+            bins[ii] = {math::BoundingBox::createEmpty(), 0};
+        }
+        for (int ii = node.first + node.count - 1; ii >= node.first; --ii)
+        {
+            const int primitive = bvh->indices[ii];
+            Bin& bin = bins[binOf(primitive)];
+            bin.bounds.add(primitives[primitive]);
+            ++bin.count;
+        }
+
+        // Sweep from the right to collect the cost of every right hand side, then from the left to find the best split
+        float rightCost[BIN_COUNT];
+        {
+            math::BoundingBox bounds = math::BoundingBox::createEmpty();
+            int count = 0;
+            for (int ii = BIN_COUNT - 1; ii > 0; --ii)
+            {
+                bounds.add(bins[ii].bounds);
+                count += bins[ii].count;
+                rightCost[ii] = bounds.getSurfaceArea() * count;
+            }
+        }
+
+        float bestCost = node.bounds.getSurfaceArea() * node.count;
+        int bestSplit = -1;
+        {
+            math::BoundingBox bounds = math::BoundingBox::createEmpty();
+            int count = 0;
+            for (int ii = 1; ii < BIN_COUNT; ++ii)
+            {
+                bounds.add(bins[ii - 1].bounds);
+                count += bins[ii - 1].count;
+                const float cost = bounds.getSurfaceArea() * count + rightCost[ii];
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestSplit = ii;
+                }
+            }
+        }
+
+        if (bestSplit < 0 && node.count <= MAX_LEAF_SIZE)
+        {
+            return false;
+        }
+
+        int* begin = bvh->indices.data() + node.first;
+        int* end = begin + node.count;
+        int* middle = begin;
+        if (bestSplit > -1)
+        {
+            middle = std::partition(begin, end, [&](int primitive) { return binOf(primitive) < bestSplit; });
+        }
+        if (middle == begin || middle == end)
+        {
+            // Splitting on the heuristic failed, fall back to a median split to keep leaves small
+            middle = begin + node.count / 2;
+            std::nth_element(begin, middle, end, [&](int a, int b) { return getAxis(centers[a], axis) < getAxis(centers[b], axis); });
+        }
+
+        return addChildren(bvh, nodeIdx, static_cast<int>(middle - begin), primitives);
+    }
+}
+
+const Bvh Bvh::create(const std::vector<math::BoundingBox>& primitives)
+{
+    Bvh bvh;
+    if (primitives.empty()) { return bvh; }
+
+    const int count = static_cast<int>(primitives.size());
+    std::vector<math::Vec3f> centers(count);
+    bvh.indices.resize(count);
+    math::BoundingBox rootBounds = math::BoundingBox::createEmpty();
+    for (int ii = count - 1; ii >= 0; --ii)
+    {
+        centers[ii] = primitives[ii].getCenter();
+        bvh.indices[ii] = ii;
+        rootBounds.add(primitives[ii]);
+    }
+
+    bvh.nodes.reserve(count * 2);
+    bvh.nodes.push_back({rootBounds, 0, count});
+    bvh.parents.reserve(count * 2);
+    bvh.parents.push_back(-1);
+
+    std::vector<BuildEntry> stack;
+    stack.push_back({0, 0});
+    while (!stack.empty())
+    {
+        const BuildEntry entry = stack.back();
+        stack.pop_back();
+        if (splitNode(&bvh, entry.node, entry.depth, primitives, centers))
+        {
+            const int childIdx = bvh.nodes[entry.node].first;
+            stack.push_back({childIdx, entry.depth + 1});
+            stack.push_back({childIdx + 1, entry.depth + 1});
+        }
+    }
+
+    bvh.leaves.resize(count);
+    for (int nodeIdx = util::lastIndex(bvh.nodes); nodeIdx >= 0; --nodeIdx)
+    {
+        const Node& node = bvh.nodes[nodeIdx];
+        for (int ii = node.first + node.count - 1; node.isLeaf() && ii >= node.first; --ii)
+        {
+            bvh.leaves[bvh.indices[ii]] = nodeIdx;
+        }
+    }
+
+    return bvh;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "BoundingBox.hpp"
+#include "Assert.hpp"
+#include <vector>
+
+// Bounding volume hierarchy over an arbitrary list of primitives, only their bounds are needed to build it.
+struct Bvh
+{
+    struct Node
+    {
+        math::BoundingBox bounds;
+        int first;  // Leaf: offset into indices, inner node: index of the left child (right child follows it)
+        int count;  // Leaf: number of primitives, inner node: 0
+
+        bool isLeaf() const { return count > 0; }
+    };
+
+    static const int MAX_DEPTH = 64; // Deepest level of a leaf below the root, traversal stacks are sized for it
+
+    std::vector<Node> nodes;
+    std::vector<int> indices;
+    std::vector<int> parents;   // Parent of every node, -1 for the root
+    std::vector<int> leaves;    // Leaf node containing each primitive
+
+    static const Bvh create(const std::vector<math::BoundingBox>& primitives);
+    bool isEmpty() const { return nodes.empty(); }
+
+    // Updates the bounds of the nodes above a primitive that changed, getBounds(primitive) yields the new bounds
+    template<typename GetBounds>
+    void refit(int primitive, const GetBounds& getBounds);
+};
+
+template<typename GetBounds>
+void Bvh::refit(int primitive, const GetBounds& getBounds)
+{
+    ASSERT(0 <= primitive && primitive < static_cast<int>(leaves.size()));
+    int nodeIdx = leaves[primitive];
+    {
+        Node& leaf = nodes[nodeIdx];
+        leaf.bounds = math::BoundingBox::createEmpty();
+        for (int ii = leaf.first + leaf.count - 1; ii >= leaf.first; --ii)
+        {
+            leaf.bounds.add(getBounds(indices[ii]));
+        }
+    }
+
+    for (nodeIdx = parents[nodeIdx]; nodeIdx > -1; nodeIdx = parents[nodeIdx])
+    {
+        Node& node = nodes[nodeIdx];
+        math::BoundingBox bounds = nodes[node.first].bounds;
+        bounds.add(nodes[node.first + 1].bounds);
+        if (bounds.min == node.bounds.min && bounds.max == node.bounds.max)
+        {
+            // Nothing changes further up the tree
+            break;
+        }
+        node.bounds = bounds;
+    }
+}
@@ -0,0 +1,121 @@
+#include "CameraPath.hpp"
+#include "Math.hpp"
+#include "Util.hpp"
+#include "Assert.hpp"
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+    static const char COMMENT_PREFIX = '#';
+    static const int KEY_FIELD_COUNT = 6;
+    static const math::Vec3f UP{0.0f, 0.0f, 1.0f};
+
+    const math::Vec3f calcDirection(float pitch, float yaw)
+    {
+        static const math::Vec3f UNIT_X{1.0f, 0.0f, 0.0f};
+        static const math::Vec3f UNIT_Y{0.0f, 1.0f, 0.0f};
+
+        const auto rotZ = math::createRotationMatrix(UP, math::deg2rad(yaw));
+        const auto rotY = math::createRotationMatrix(UNIT_Y, math::deg2rad(pitch));
+        return rotZ * rotY * UNIT_X;
+    }
+
+    // Passes through b at t = 0 and c at t = 1, a and d only shape the tangents
+    const math::Vec3f interpolateCatmullRom(const math::Vec3f& a, const math::Vec3f& b, const math::Vec3f& c, const math::Vec3f& d, float t)
+    {
+        const float t2 = t * t;
+        const float t3 = t2 * t;
+        return (b * 2.0f + (c - a) * t + (a * 2.0f - b * 5.0f + c * 4.0f - d) * t2 + (b * 3.0f - a - c * 3.0f + d) * t3) * 0.5f;
+    }
+}
+
+bool CameraPath::parse(const char* text, size_t length, CameraPath* path, std::string* error)
+{
+    const char* textEnd = text + length;
+    int lineNumber = 0;
+    for (const char* line = text; line < textEnd; )
+    {
+        const char* lineEnd = line;
+        while (lineEnd < textEnd && *lineEnd != '\n') { ++lineEnd; }
+        const std::string content(line, lineEnd);
+        line = lineEnd + 1;
+        ++lineNumber;
+
+        const size_t first = content.find_first_not_of(" \t\r");
+        if (first == std::string::npos || content[first] == COMMENT_PREFIX)
+        {
+            continue;
+        }
+
+        float values[KEY_FIELD_COUNT];
+        const char* field = content.c_str();
+        for (int ii = 0; ii < KEY_FIELD_COUNT; ++ii)
+        {
+            char* fieldEnd;
+            values[ii] = std::strtof(field, &fieldEnd);
+            if (fieldEnd == field)
+            {
+                *error = "Line " + std::to_string(lineNumber) + ": expected time x y z pitch yaw";
+                return false;
+            }
+            field = fieldEnd;
+        }
+
+        const Key key = {values[0], {values[1], values[2], values[3]}, calcDirection(values[4], values[5])};
+        if (!path->keys.empty() && key.time < path->keys.back().time)
+        {
+            *error = "Line " + std::to_string(lineNumber) + ": keys have to be ordered by time";
+            return false;
+        }
+        path->keys.push_back(key);
+    }
+
+    if (path->keys.empty())
+    {
+        *error = "No keys in camera path";
+        return false;
+    }
+    return true;
+}
+
+const CameraPath CameraPath::createFromPoints(const std::vector<math::Vec3f>& points, float speed)
+{
+    CameraPath path;
+    float time = 0.0f;
+    for (int ii = 0; ii < static_cast<int>(points.size()); ++ii)
+    {
+        const int previous = math::max(ii - 1, 0);
+        const int next = math::min(ii + 1, util::lastIndex(points));
+        if (ii > 0)
+        {
+            time += math::distance(points[previous], points[ii]) / speed;
+        }
+
+        // Looks along the path, on a single point there is no path to look along
+        const math::Vec3f along = points[next] - points[previous];
+        const math::Vec3f direction = math::length2(along) > 0.0f ? math::normalized(along) : calcDirection(0.0f, 0.0f);
+        path.keys.push_back({time, points[ii], direction});
+    }
+    return path;
+}
+
+const Camera CameraPath::sample(float time, const Camera& lens) const
+{
+    ASSERT(!keys.empty());
+    const int last = util::lastIndex(keys);
+    int idx = 0;
+    while (idx < last && keys[idx + 1].time <= time) { ++idx; }
+    const int next = math::min(idx + 1, last);
+
+    const float span = keys[next].time - keys[idx].time;
+    const float t = span > 0.0f ? math::clamp((time - keys[idx].time) / span, 0.0f, 1.0f) : 0.0f;
+    const math::Vec3f origin = interpolateCatmullRom(keys[math::max(idx - 1, 0)].origin, keys[idx].origin, keys[next].origin, keys[math::min(next + 1, last)].origin, t);
+
+    // Opposite directions blend to nothing halfway, keep the first one then
+    const math::Vec3f blended = keys[idx].direction * (1.0f - t) + keys[next].direction * t;
+    const math::Vec3f direction = math::length2(blended) > 1e-6f ? math::normalized(blended) : keys[idx].direction;
+
+    Camera camera = lens;
+    camera.setPosition(origin, direction, UP);
+    return camera;
+}
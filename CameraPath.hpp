@@ -0,0 +1,30 @@
+#pragma once
+
+#include "Camera.hpp"
+#include "Vec3.hpp"
+#include <vector>
+#include <string>
+#include <cstddef>
+
+// Keyframed camera motion, the origin follows a Catmull-Rom spline through the keys
+struct CameraPath
+{
+    struct Key
+    {
+        float time; // Seconds since the start of the path
+        math::Vec3f origin;
+        math::Vec3f direction;
+    };
+
+    std::vector<Key> keys; // Ordered by time
+
+    // One "time x y z pitch yaw" key per line, angles in degrees like the mangle of an intermission camera.
+    // Empty lines and lines starting with # are skipped.
+    static bool parse(const char* text, size_t length, CameraPath* path, std::string* error);
+    // Keys paced evenly along the points at the given speed in units per second, each looking along the path
+    static const CameraPath createFromPoints(const std::vector<math::Vec3f>& points, float speed);
+
+    float getDuration() const { return keys.empty() ? 0.0f : keys.back().time; }
+    // Moves a copy of the lens to the interpolated position, the view angles stay untouched
+    const Camera sample(float time, const Camera& lens) const;
+};
@@ -4,6 +4,98 @@
 #include "Assert.hpp"
 #include <limits>
 
+namespace {
+    static const int BVH_STACK_SIZE = 128;
+    // Every level holds at most one pending sibling, plus both children of the deepest inner node
+    static_assert(BVH_STACK_SIZE >= Bvh::MAX_DEPTH + 1, "Traversal stack cannot hold the deepest hierarchy");
+
+    // Walks the leaves of the hierarchy front to back, visitor(primitive, &maxDist) returns true on a hit and
+    // may shorten maxDist. Returns whether anything was hit, stops at the first hit when ANY_HIT is set.
+    template<bool ANY_HIT, typename Visitor>
+    bool traverseBvh(const Bvh& bvh, const Ray& ray, const math::Vec3f& invDir, float* maxDist, Visitor& visitor)
+    {
+        if (bvh.isEmpty() || !collision3d::rayBoxIntersection(ray, invDir, bvh.nodes[0].bounds, *maxDist))
+        {
+            return false;
+        }
+
+        bool hit = false;
+        int stack[BVH_STACK_SIZE];
+        int stackSize = 0;
+        stack[stackSize++] = 0;
+        while (stackSize > 0)
+        {
+            const Bvh::Node& node = bvh.nodes[stack[--stackSize]];
+            if (node.isLeaf())
+            {
+                for (int ii = node.first + node.count - 1; ii >= node.first; --ii)
+                {
+                    if (visitor(bvh.indices[ii], maxDist))
+                    {
+                        if (ANY_HIT) { return true; }
+                        hit = true;
+                    }
+                }
+                continue;
+            }
+
+            float tLeft = 0.0f, tRight = 0.0f;
+            const bool hitLeft = collision3d::rayBoxIntersection(ray, invDir, bvh.nodes[node.first].bounds, *maxDist, &tLeft);
+            const bool hitRight = collision3d::rayBoxIntersection(ray, invDir, bvh.nodes[node.first + 1].bounds, *maxDist, &tRight);
+            ASSERT(stackSize + 2 <= BVH_STACK_SIZE);
+            if (hitLeft && hitRight)
+            {
+                // Push the far child first so the near one gets processed first
+                const bool leftFirst = tLeft <= tRight;
+                stack[stackSize++] = leftFirst ? node.first + 1 : node.first;
+                stack[stackSize++] = leftFirst ? node.first : node.first + 1;
+            }
+            else if (hitLeft)
+            {
+                stack[stackSize++] = node.first;
+            }
+            else if (hitRight)
+            {
+                stack[stackSize++] = node.first + 1;
+            }
+        }
+        return hit;
+    }
+
+    template<bool ANY_HIT>
+    bool raycastInstances(const Ray& ray, float* maxDist, const SceneView& view, int* polygonIdx, int* instanceIdx)
+    {
+        const Scene& scene = *view.scene;
+        const math::Vec3f invDir(1.0f / ray.dir.x, 1.0f / ray.dir.y, 1.0f / ray.dir.z);
+
+        auto instanceVisitor = [&](int instance, float* instanceMaxDist)
+        {
+            const Scene::ModelInstance& inst = scene.instances[instance];
+            if (!inst.visible || !view.hasInstance(instance)) { return false; }
+
+            const Scene::Model& model = scene.models[inst.model];
+            const Ray localRay = { ray.origin - inst.origin, ray.dir };
+            auto polygonVisitor = [&](int polygon, float* polygonMaxDist)
+            {
+                const int idx = model.firstPolygon + polygon;
+                const Scene::ConvexPolygon& poly = scene.polygons[idx];
+                float dist = 0.0f;
+                if (!view.hasPolygon(poly) || !collision3d::rayConvexPolygonIntersection(localRay, poly, *polygonMaxDist, &dist))
+                {
+                    return false;
+                }
+                *polygonMaxDist = dist;
+                if (polygonIdx) { *polygonIdx = idx; }
+                if (instanceIdx) { *instanceIdx = instance; }
+                return true;
+            };
+            return traverseBvh<ANY_HIT>(model.bvh, localRay, invDir, instanceMaxDist, polygonVisitor);
+        };
+
+        return traverseBvh<ANY_HIT>(scene.instanceBvh, ray, invDir, maxDist, instanceVisitor);
+    }
+}
+
 bool collision3d::rayPlaneIntersection(const Ray& ray, const math::Vec3f& planeOrigin, const math::Vec3f& planeNormal, float* t)
 {
     ASSERT(t);
@@ -14,6 +106,60 @@ bool collision3d::rayPlaneIntersection(const Ray& ray, const math::Vec3f& planeO
     return true;
 }
 
+bool collision3d::rayBoxIntersection(const Ray& ray, const math::Vec3f& invDir, const math::BoundingBox& box, float maxDist, float* t)
+{
+    // Slab test, NaNs from axis aligned rays starting on a slab boundary are discarded by min/max
+    float t1 = (box.min.x - ray.origin.x) * invDir.x;
+    float t2 = (box.max.x - ray.origin.x) * invDir.x;
+    float tMin = math::min(t1, t2);
+    float tMax = math::max(t1, t2);
+
+    t1 = (box.min.y - ray.origin.y) * invDir.y;
+    t2 = (box.max.y - ray.origin.y) * invDir.y;
+    tMin = math::max(tMin, math::min(t1, t2));
+    tMax = math::min(tMax, math::max(t1, t2));
+
+    t1 = (box.min.z - ray.origin.z) * invDir.z;
+    t2 = (box.max.z - ray.origin.z) * invDir.z;
+    tMin = math::max(tMin, math::min(t1, t2));
+    tMax = math::min(tMax, math::max(t1, t2));
+
+    if (tMax < math::max(tMin, 0.0f) || tMin > maxDist) { return false; }
+    if (t) { *t = tMin; }
+    return true;
+}
+
+bool collision3d::rayConvexPolygonIntersection(const Ray& ray, const Scene::ConvexPolygon& poly, float maxDist, float* t)
+{
+    ASSERT(t);
+
+    // Perform plane intersection
+    float dist = 0.0f;
+    bool intersects = rayPlaneIntersection(ray, poly.plane.origin, poly.plane.normal, &dist);
+    if (!intersects && poly.flags[Scene::ConvexPolygon::FLAG_TWOSIDED])
+    {
+        intersects = rayPlaneIntersection(ray, poly.plane.origin, -poly.plane.normal, &dist);
+    }
+    if (!intersects || dist < 0 || dist > maxDist) { return false; }
+
+    math::Vec3f intersection = ray.dir * dist + ray.origin;
+
+    // Detect whether intersection point lies in front of each edge plane
+    for (int jj = util::lastIndex(poly.edgePlanes); jj >= 0; --jj)
+    {
+        const auto& plane = poly.edgePlanes[jj];
+        auto relative = intersection - plane.origin;
+        if (math::dot(relative, plane.normal) < 0)
+        {
+            // behind plane
+            return false;
+        }
+    }
+
+    *t = dist;
+    return true;
+}
+
 int collision3d::raycastSpheres(const Ray& ray, float maxDist, const std::vector<Scene::Sphere>& spheres, Hit* hitResult)
 {
     float minDist = maxDist;
@@ -143,49 +289,46 @@ int collision3d::raycastConvexPolygons(const Ray& ray, float maxDist, const std:
 {
     float minDist = maxDist;
     int minIndex = -1;
-    math::Vec3f minNormal;
     for (int ii = util::lastIndex(polygons); ii >= 0; --ii)
     {
-        const auto& poly = polygons[ii];
-
-        // Actual collision algorithm
-
-        // Perform plane intersection
         float dist = 0.0f;
-        bool intersects = rayPlaneIntersection(ray, poly.plane.origin, poly.plane.normal, &dist);
-        if (!intersects && poly.flags[Scene::ConvexPolygon::FLAG_TWOSIDED])
+        if (rayConvexPolygonIntersection(ray, polygons[ii], minDist, &dist))
         {
-            intersects = rayPlaneIntersection(ray, poly.plane.origin, -poly.plane.normal, &dist);
+            minDist = dist;
+            minIndex = ii;
         }
-        if (!intersects || dist < 0 || dist > minDist) { continue; }
+    }
 
-        math::Vec3f intersection = ray.dir * dist + ray.origin;
+    if (minIndex > -1 && hitResult)
+    {
+        hitResult->pos = ray.origin + ray.dir * minDist;
+        hitResult->normal = polygons[minIndex].plane.normal;
+        hitResult->t = minDist;
+    }
 
-        // Detect whether intersection point lies in front of each edge plane
-        for (int jj = util::lastIndex(poly.edgePlanes); jj >= 0; --jj)
-        {
-            const auto& plane = poly.edgePlanes[jj];
-            auto relative = intersection - plane.origin;
-            if (math::dot(relative, plane.normal) < 0)
-            {
-                // behind plane
-                goto poly_end;
-            }
-        }
+    return minIndex;
+}
 
-        minDist = dist;
-        minIndex = ii;
-        minNormal = poly.plane.normal;
-poly_end:
-        ;
+int collision3d::raycastModels(const Ray& ray, float maxDist, const SceneView& view, Hit* hitResult, int* instanceIdx)
+{
+    float minDist = maxDist;
+    int minIndex = -1;
+    if (!raycastInstances<false>(ray, &minDist, view, &minIndex, instanceIdx))
+    {
+        return -1;
     }
 
-    if (minIndex > -1 && hitResult)
+    if (hitResult)
     {
         hitResult->pos = ray.origin + ray.dir * minDist;
-        hitResult->normal = minNormal;
+        hitResult->normal = view.scene->polygons[minIndex].plane.normal;
         hitResult->t = minDist;
     }
 
     return minIndex;
 }
+
+bool collision3d::rayModelsCollision(const Ray& ray, float maxDist, const SceneView& view)
+{
+    return raycastInstances<true>(ray, &maxDist, view, nullptr, nullptr);
+}
@@ -15,19 +15,24 @@ namespace collision3d
     };
 
     bool rayPlaneIntersection(const Ray& ray, const math::Vec3f& planeOrigin, const math::Vec3f& planeNormal, float* t);
-    bool raySceneCollision(const Ray& ray, float maxDist, const Scene& scene);
+    bool rayBoxIntersection(const Ray& ray, const math::Vec3f& invDir, const math::BoundingBox& box, float maxDist, float* t = nullptr);
+    bool rayConvexPolygonIntersection(const Ray& ray, const Scene::ConvexPolygon& poly, float maxDist, float* t);
+    bool raySceneCollision(const Ray& ray, float maxDist, const SceneView& view);
     int raycastSpheres(const Ray& ray, float maxDist, const std::vector<Scene::Sphere>& spheres, Hit* hitResult = nullptr);
     int raycastPlanes(const Ray& ray, float maxDist, const std::vector<Scene::Plane>& planes, Hit* hitResult = nullptr);
     int raycastTriangles(const Ray& ray, float maxDist, const std::vector<Scene::Triangle>& triangles, Hit* hitResult = nullptr);
     int raycastConvexPolygons(const Ray& ray, float maxDist, const std::vector<Scene::ConvexPolygon>& polygons, Hit* hitResult = nullptr);
+    int raycastModels(const Ray& ray, float maxDist, const SceneView& view, Hit* hitResult = nullptr, int* instanceIdx = nullptr);
+    bool rayModelsCollision(const Ray& ray, float maxDist, const SceneView& view);
 }
 
-inline bool collision3d::raySceneCollision(const Ray& ray, float maxDist, const Scene& scene)
+inline bool collision3d::raySceneCollision(const Ray& ray, float maxDist, const SceneView& view)
 {
+    const Scene& scene = *view.scene;
     return false
     || collision3d::raycastSpheres(ray, maxDist, scene.spheres) > -1
     || collision3d::raycastPlanes(ray, maxDist, scene.planes) > -1
     || collision3d::raycastTriangles(ray, maxDist, scene.triangles) > -1
-    || collision3d::raycastConvexPolygons(ray, maxDist, scene.polygons) > -1
+    || collision3d::rayModelsCollision(ray, maxDist, view)
     ;
 }
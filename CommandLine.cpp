@@ -86,9 +86,19 @@ void util::Arg::appendHelp(std::vector<char> *buffer) const
     appendFlag(buffer, ", ");
     if (!required && !getArgumentType().empty())
     {
+        const size_t start = buffer->size();
         util::StringTool::append(buffer, " (defaults to ");
+        const size_t valueStart = buffer->size();
         appendDefaultValue(buffer);
-        buffer->push_back(')');
+        if (buffer->size() == valueStart)
+        {
+            // Empty defaults (optional paths) are left out
+            buffer->resize(start);
+        }
+        else
+        {
+            buffer->push_back(')');
+        }
     }
     util::StringTool::append(buffer, "\n\t");
     util::StringTool::appendWrapped(buffer, help, 60, "\n\t");
@@ -104,7 +114,8 @@ bool util::Arg::matchFlag(const char* arg) const
     return arg[1] == COMMANDLINE_ARGUMENT_PREFIX && !flag.compare(&arg[2]);
 }
 
-bool util::Arg::isFlag(const char* arg) const { return arg[0] == COMMANDLINE_ARGUMENT_PREFIX; }
+// A lone - is a value, it names standard input or output
+bool util::Arg::isFlag(const char* arg) const { return arg[0] == COMMANDLINE_ARGUMENT_PREFIX && arg[1] != '\0'; }
 
 void util::Arg::appendFlag(std::vector<char>* buffer, const char* separator) const
 {
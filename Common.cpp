@@ -4,20 +4,92 @@
 #include "AppConfig.hpp"
 #include "RayTracer.hpp"
 #include "File.hpp"
+#include "PakFile.hpp"
+#include "SceneCache.hpp"
+#include "CameraPath.hpp"
+#include "ModelAnimation.hpp"
+#include "Logger.hpp"
 #include "Targa.hpp"
+#include "Qoi.hpp"
+#include "FrameStream.hpp"
+#include "Scheduler.hpp"
 #include "Util.hpp"
+#include "Math.hpp"
+#include <cstdio>
+#include <cstring>
+#include <memory>
 
-bool common::loadBSP(const char* filename, Scene* scene, int screenWidth, int screenHeight)
+namespace {
+    static const char PAK_PALETTE_ENTRY[] = "gfx/palette.lmp";
+    static const char TGA_IDENTIFIER[] = "Raytraced Quake Level";
+    static const float PATH_CORNER_SPEED = 200.0f; // Units per second, a little below the running speed of the player
+
+    // Hands the level data to load, either from a plain BSP file or from an "archive.pak:maps/level.bsp" entry.
+    // Archives also provide the palette when they contain one. The data is only mapped while load runs.
+    template<typename Load>
+    bool withLevelData(const char* filename, const Load& load)
+    {
+        std::string archive, entry;
+        if (PakFile::splitPath(filename, &archive, &entry))
+        {
+            PakFile pak = PakFile::open(archive.c_str());
+            PakFile::Entry level, palette;
+            if (!pak.isValid() || !pak.find(entry.c_str(), &level))
+            {
+                return false;
+            }
+
+            const bool hasPalette = pak.find(PAK_PALETTE_ENTRY, &palette) && palette.size >= Palette::SIZE * 3;
+            return load(level.data, level.size, hasPalette ? palette.data : nullptr);
+        }
+
+        FileMapping mapFile = FileMapping::open(filename);
+        return mapFile.isValid() && load(mapFile.getData(), mapFile.size(), nullptr);
+    }
+}
+
+bool common::loadBSP(const char* filename, const BspLoader::Options& options, const std::string& cacheFile, Scene* scene, int screenWidth, int screenHeight)
 {
-    File mapFile = File::open(filename);
-    if (!mapFile.isValid())
+    // The loader only reads the lumps it needs, mapping the file keeps the rest on disk
+    const bool loaded = withLevelData(filename, [&](const void* data, size_t size, const void* palette)
+    {
+        if (!BspLoader::isValidBsp(data, size))
+        {
+            return false;
+        }
+
+        BspLoader::Options levelOptions = options;
+        if (palette)
+        {
+            levelOptions.palette = palette;
+        }
+
+        if (cacheFile.empty())
+        {
+            *scene = BspLoader::createSceneFromBsp(data, static_cast<int>(size), levelOptions);
+            return true;
+        }
+
+        // The key hashes the whole file, only pay for touching every page when there is a cache to match
+        const std::uint64_t cacheKey = SceneCache::calcKey(data, size, levelOptions);
+        if (SceneCache::load(cacheFile.c_str(), cacheKey, scene))
+        {
+            LOG("Loaded scene from cache: %s\n", cacheFile.c_str());
+        }
+        else
+        {
+            *scene = BspLoader::createSceneFromBsp(data, static_cast<int>(size), levelOptions);
+            if (!SceneCache::save(cacheFile.c_str(), cacheKey, *scene))
+            {
+                LOG("Could not write scene cache: %s\n", cacheFile.c_str());
+            }
+        }
+        return true;
+    });
+    if (!loaded)
     {
         return false;
     }
-    size_t mapDataSize = mapFile.size();
-    std::vector<std::uint8_t> mapData(mapDataSize);
-    mapFile.read(mapData.data(), mapDataSize);
-    *scene = BspLoader::createSceneFromBsp(mapData.data(), mapDataSize);
 
     // Correct for aspect ratio
     for (int ii = util::lastIndex(scene->cameras); ii >= 0; --ii)
@@ -27,10 +99,135 @@ bool common::loadBSP(const char* filename, Scene* scene, int screenWidth, int sc
     return true;
 }
 
+bool common::loadInfo(const char* filename, BspLoader::Info* info)
+{
+    // The header check skips the texture lumps the full check walks, so only the header, the entity lump and the first
+    // entries of the model and texture lumps are touched and the rest of the mapping is never paged in
+    return withLevelData(filename, [&](const void* data, size_t size, const void*)
+    {
+        if (!BspLoader::isValidHeader(data, size))
+        {
+            return false;
+        }
+
+        *info = BspLoader::readInfo(data, size);
+        return true;
+    });
+}
+
+bool common::loadCameraPath(const AppConfig& config, CameraPath* path, std::string* error)
+{
+    if (config.flythrough == AppConfig::PATH_CORNER_FLYTHROUGH)
+    {
+        const bool loaded = withLevelData(config.mapFile.c_str(), [&](const void* data, size_t size, const void*)
+        {
+            if (!BspLoader::isValidHeader(data, size))
+            {
+                return false;
+            }
+
+            *path = BspLoader::readCameraPath(data, size, PATH_CORNER_SPEED);
+            return true;
+        });
+        if (!loaded || path->keys.empty())
+        {
+            *error = loaded ? "No path_corner entities in map file: " + config.mapFile : "Could not open map file: " + config.mapFile;
+            return false;
+        }
+        return true;
+    }
+
+    FileMapping keyFile = FileMapping::open(config.flythrough.c_str());
+    if (!keyFile.isValid())
+    {
+        *error = "Could not open flythrough file: " + config.flythrough;
+        return false;
+    }
+    return CameraPath::parse(static_cast<const char*>(keyFile.getData()), keyFile.size(), path, error);
+}
+
+bool common::loadModelAnimation(const AppConfig& config, ModelAnimation* animation, std::string* error)
+{
+    FileMapping keyFile = FileMapping::open(config.animation.c_str());
+    if (!keyFile.isValid())
+    {
+        *error = "Could not open animation file: " + config.animation;
+        return false;
+    }
+    return ModelAnimation::parse(static_cast<const char*>(keyFile.getData()), keyFile.size(), animation, error);
+}
+
+namespace {
+    void appendVec3f(std::string* json, const char* name, const math::Vec3f& vec)
+    {
+        char buffer[128];
+        std::snprintf(buffer, sizeof(buffer), "\"%s\":[%g,%g,%g]", name, vec.x, vec.y, vec.z);
+        json->append(buffer);
+    }
+
+    void appendInteger(std::string* json, const char* name, int value)
+    {
+        char buffer[64];
+        std::snprintf(buffer, sizeof(buffer), "\"%s\":%d", name, value);
+        json->append(buffer);
+    }
+}
+
+const std::string common::formatInfoAsJson(const BspLoader::Info& info)
+{
+    std::string json = "{\"cameras\":[";
+    for (int ii = 0; ii < static_cast<int>(info.cameras.size()); ++ii)
+    {
+        json.append(ii ? ",{" : "{");
+        appendVec3f(&json, "origin", info.cameras[ii].origin);
+        json.append(",");
+        appendVec3f(&json, "angles", info.cameras[ii].angles);
+        json.append("}");
+    }
+    json.append("],\"lights\":{");
+    appendInteger(&json, "point", info.pointLightCount);
+    json.append(",");
+    appendInteger(&json, "spot", info.spotLightCount);
+    json.append("},");
+    appendInteger(&json, "faces", info.faceCount);
+    json.append(",");
+    appendInteger(&json, "textures", info.textureCount);
+    json.append(",");
+    appendInteger(&json, "models", info.modelCount);
+    json.append(",\"bounds\":{");
+    appendVec3f(&json, "min", info.bounds.min);
+    json.append(",");
+    appendVec3f(&json, "max", info.bounds.max);
+    json.append("}}");
+    return json;
+}
+
+bool common::resolveCameras(const AppConfig& config, const Scene& scene, std::vector<int>* cameraIndices, std::string* error)
+{
+    *cameraIndices = config.cameraIndices;
+    if (config.allCameras)
+    {
+        for (int ii = 0; ii < static_cast<int>(scene.cameras.size()); ++ii)
+        {
+            cameraIndices->push_back(ii);
+        }
+    }
+    for (int cameraIdx : *cameraIndices)
+    {
+        if (cameraIdx < 0 || cameraIdx >= static_cast<int>(scene.cameras.size()))
+        {
+            *error = "Camera " + std::to_string(cameraIdx) + " does not exist, the level has " + std::to_string(scene.cameras.size()) + " cameras";
+            return false;
+        }
+    }
+    return true;
+}
+
 RayTracer::Config common::parseRayTracerConfig(const AppConfig& config)
 {
     RayTracer::Config traceConfig;
     traceConfig.detail = config.detail;
+    traceConfig.projection = parseProjection(config);
     traceConfig.occlusionRayCount = config.occlusionRayCount;
     traceConfig.occlusionRayStrength = config.occlusionStrength;
     traceConfig.softshadowRayCount = config.softshadowRayCount;
@@ -38,17 +235,91 @@ RayTracer::Config common::parseRayTracerConfig(const AppConfig& config)
     traceConfig.width = config.width;
     traceConfig.height = config.height;
     traceConfig.gamma = config.gamma;
+    traceConfig.temporal = config.temporal;
     return traceConfig;
 }
 
-bool common::writeToTGA(const Image& image, const char* filename)
+BspLoader::Options common::parseLoaderOptions(const AppConfig& config)
+{
+    BspLoader::Options options;
+    options.mergeFaces = config.mergeFaces;
+    options.threads = config.threads;
+    return options;
+}
+
+RayTracer::Projection common::parseProjection(const AppConfig& config)
 {
+    switch (config.projection)
+    {
+        case AppConfig::PROJECTION_CUBEMAP: return RayTracer::PROJECTION_CUBEMAP;
+        case AppConfig::PROJECTION_EQUIRECT: return RayTracer::PROJECTION_EQUIRECT;
+        case AppConfig::PROJECTION_PERSPECTIVE:
+        default: return RayTracer::PROJECTION_PERSPECTIVE;
+    }
+}
 
-    auto tga = targa::encode(image, "Raytraced Quake Level");
-    File f = File::openW(filename);
+targa::Compression common::parseCompression(const AppConfig& config)
+{
+    return config.compressImage ? targa::COMPRESSION_RLE : targa::COMPRESSION_NONE;
+}
+
+bool common::writeToTGA(const Image& image, const char* filename, targa::Compression compression)
+{
+    auto tga = targa::encode(image, TGA_IDENTIFIER, compression);
+    File f = openOutput(filename);
     if (f.isValid())
     {
         f.write(tga.data(), tga.size());
     }
     return f.isValid();
 }
+
+targa::FileWriter common::createTGAWriter(const Image& image, const char* filename, targa::Compression compression)
+{
+    return targa::FileWriter(openOutput(filename), image, TGA_IDENTIFIER, compression);
+}
+
+File common::openOutput(const char* filename)
+{
+    return std::strcmp(filename, AppConfig::STANDARD_OUTPUT) ? File::openW(filename) : File::openStdOut();
+}
+
+const std::string common::formatOutputPath(const std::string& pattern, int cameraIdx)
+{
+    std::string path = pattern;
+    const size_t placeholder = path.find(AppConfig::CAMERA_PLACEHOLDER);
+    if (placeholder != std::string::npos)
+    {
+        path.replace(placeholder, std::strlen(AppConfig::CAMERA_PLACEHOLDER), std::to_string(cameraIdx));
+    }
+    return path;
+}
+
+bool common::writeImage(const Image& image, const char* filename, const AppConfig& config, Scheduler* scheduler)
+{
+    switch (config.imageFormat)
+    {
+        case AppConfig::IMAGE_QOI:
+            {
+                std::unique_ptr<Scheduler> ownScheduler;
+                if (!scheduler && config.threads > 1)
+                {
+                    ownScheduler.reset(new Scheduler(config.threads));
+                }
+                auto qoi = qoi::encode(image, scheduler ? scheduler : ownScheduler.get());
+                File f = openOutput(filename);
+                return f.isValid() && f.write(qoi.data(), qoi.size()) == 1;
+            }
+        case AppConfig::IMAGE_Y4M:
+        case AppConfig::IMAGE_BGRA:
+            {
+                const auto format = config.imageFormat == AppConfig::IMAGE_Y4M ? FrameStream::FORMAT_Y4M : FrameStream::FORMAT_BGRA;
+                FrameStream stream(openOutput(filename), format, image.width, image.height, config.frameRate);
+                stream.writeFrame(image);
+                return stream.isValid();
+            }
+        case AppConfig::IMAGE_TGA:
+        default:
+            return writeToTGA(image, filename, parseCompression(config));
+    }
+}
@@ -1,12 +1,32 @@
 #pragma once
 #include "RayTracer.hpp"
+#include "BspLoader.hpp"
+#include "Targa.hpp"
+#include "File.hpp"
+#include <string>
+#include <vector>
 
 struct Scene;
 struct AppConfig;
 struct Image;
+struct CameraPath;
+struct ModelAnimation;
+class Scheduler;
 
 namespace common {
-    bool loadBSP(const char* filename, Scene* scene, int screenWidth, int screenHeight);
+    bool loadInfo(const char* filename, BspLoader::Info* info);
+    const std::string formatInfoAsJson(const BspLoader::Info& info);
+    bool loadCameraPath(const AppConfig& config, CameraPath* path, std::string* error);
+    bool loadModelAnimation(const AppConfig& config, ModelAnimation* animation, std::string* error);
+    bool loadBSP(const char* filename, const BspLoader::Options& options, const std::string& cacheFile, Scene* scene, int screenWidth, int screenHeight);
+    bool resolveCameras(const AppConfig& config, const Scene& scene, std::vector<int>* cameraIndices, std::string* error); // Expands all, fails on an index the level does not have
     RayTracer::Config parseRayTracerConfig(const AppConfig& config);
-    bool writeToTGA(const Image& image, const char* filename);
+    BspLoader::Options parseLoaderOptions(const AppConfig& config);
+    RayTracer::Projection parseProjection(const AppConfig& config);
+    targa::Compression parseCompression(const AppConfig& config);
+    bool writeToTGA(const Image& image, const char* filename, targa::Compression compression);
+    targa::FileWriter createTGAWriter(const Image& image, const char* filename, targa::Compression compression);
+    File openOutput(const char* filename); // "-" is standard output
+    const std::string formatOutputPath(const std::string& pattern, int cameraIdx);
+    bool writeImage(const Image& image, const char* filename, const AppConfig& config, Scheduler* scheduler = nullptr);
 }
@@ -8,8 +8,140 @@
 #include "Util.hpp"
 #include "Math.hpp"
 #include "Common.hpp"
+#include "Batch.hpp"
+#include "Qoi.hpp"
+#include "FrameStream.hpp"
+#include "Scheduler.hpp"
+#include "CameraPath.hpp"
+#include "ModelAnimation.hpp"
 #include <cstdio>
 #include <cstdlib>
+#include <memory>
+
+namespace {
+    // A viewpoint and the number that replaces the placeholder in its output path
+    struct Shot
+    {
+        Camera camera;
+        int number;
+        float time; // Moment of the model animation the shot shows
+    };
+
+    // Renders one strip of rows at a time and writes it out before the next, only a single strip is ever in memory
+    template<typename PrintProgress>
+    bool traceInStrips(const Scene& scene, const Camera& camera, const AppConfig& config, const char* filename, Scheduler* scheduler, const PrintProgress& printProgress)
+    {
+        RayTracer engine(common::parseRayTracerConfig(config));
+        std::unique_ptr<qoi::FileWriter> qoiWriter;
+        std::unique_ptr<FrameStream> rawWriter;
+        if (config.imageFormat == AppConfig::IMAGE_QOI)
+        {
+            qoiWriter.reset(new qoi::FileWriter(common::openOutput(filename), config.width, config.height));
+        }
+        else
+        {
+            rawWriter.reset(new FrameStream(common::openOutput(filename), FrameStream::FORMAT_BGRA, config.width, config.height));
+        }
+        auto isValid = [&]() { return qoiWriter ? qoiWriter->isValid() : rawWriter->isValid(); };
+
+        Image strip(config.width, math::min(config.stripHeight, config.height), Image::FORMAT_ARGB);
+        for (int firstRow = 0; firstRow < config.height && isValid(); firstRow += strip.height)
+        {
+            const int rowCount = math::min(strip.height, config.height - firstRow);
+            if (rowCount < strip.height)
+            {
+                strip = Image(config.width, rowCount, Image::FORMAT_ARGB);
+            }
+
+            engine.startTrace(scene, camera, firstRow, &strip, scheduler);
+            while (!engine.isFinished())
+            {
+                std::this_thread::yield();
+            }
+
+            if (qoiWriter)
+            {
+                qoiWriter->writeRows(strip, scheduler);
+            }
+            else
+            {
+                rawWriter->writeRows(strip);
+            }
+            printProgress((firstRow + rowCount) / static_cast<float>(config.height));
+        }
+        return isValid();
+    }
+
+    // Traces the shots one after another with two tracers taking turns. The next shot is queued as soon as every row
+    // of the current one has been handed out, so workers move on to it while the last rows finish and the image is written.
+    // Temporal reuse needs the finished previous frame, one tracer then traces every shot after the other.
+    // Animated models are moved between shots, which only happens once no worker traces the scene anymore.
+    template<typename PrintProgress>
+    bool traceShots(Scene* scene, const ModelAnimation* animation, const std::vector<Shot>& shots, const AppConfig& config, const PrintProgress& printProgress)
+    {
+        const RayTracer::Config traceConfig = common::parseRayTracerConfig(config);
+        RayTracer firstEngine(traceConfig), secondEngine(traceConfig);
+        RayTracer* engines[] = { &firstEngine, &secondEngine };
+        Image firstCanvas(config.width, config.height, Image::FORMAT_ARGB), secondCanvas(config.width, config.height, Image::FORMAT_ARGB);
+        Image* canvases[] = { &firstCanvas, &secondCanvas };
+        // Declared last so the workers are stopped before the tracers they work for go away
+        Scheduler scheduler(config.threads);
+
+        // Without a placeholder in the output path every shot becomes a frame of the same stream
+        std::unique_ptr<FrameStream> stream;
+        if (config.imageFile.find(AppConfig::CAMERA_PLACEHOLDER) == std::string::npos)
+        {
+            const auto format = config.imageFormat == AppConfig::IMAGE_Y4M ? FrameStream::FORMAT_Y4M : FrameStream::FORMAT_BGRA;
+            stream.reset(new FrameStream(common::openOutput(config.imageFile.c_str()), format, config.width, config.height, config.frameRate));
+        }
+
+        const int shotCount = static_cast<int>(shots.size());
+        const bool overlapShots = !config.temporal && !animation;
+        auto startShot = [&](int ii)
+        {
+            if (animation)
+            {
+                animation->apply(shots[ii].time, scene);
+            }
+            engines[config.temporal ? 0 : ii % 2]->startTrace(*scene, shots[ii].camera, 0, canvases[ii % 2], &scheduler);
+        };
+
+        startShot(0);
+        for (int ii = 0; ii < shotCount; ++ii)
+        {
+            const RayTracer& engine = *engines[config.temporal ? 0 : ii % 2];
+            bool nextStarted = ii + 1 == shotCount;
+            while (!engine.isFinished())
+            {
+                if (!nextStarted && overlapShots && !scheduler.hasQueuedTasks())
+                {
+                    startShot(ii + 1);
+                    nextStarted = true;
+                }
+                printProgress((ii + engine.getProgress()) / shotCount);
+                std::this_thread::yield();
+            }
+            printProgress((ii + 1.0f) / shotCount);
+
+            if (!nextStarted)
+            {
+                startShot(ii + 1);
+            }
+
+            const Image& canvas = *canvases[ii % 2];
+            if (stream)
+            {
+                stream->writeFrame(canvas);
+                if (!stream->isValid()) { return false; }
+            }
+            else if (!common::writeImage(canvas, common::formatOutputPath(config.imageFile, shots[ii].number).c_str(), config))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+}
 
 int Console::runUntilFinished(int argc, char const * const * const argv)
 {
@@ -29,59 +161,216 @@ int Console::runUntilFinished(int argc, char const * const * const argv)
         }
     }
 
-    Scene scene;
-    if (!common::loadBSP(config.mapFile.c_str(), &scene, config.width, config.height))
+    if (!config.batchFile.empty())
+    {
+        std::vector<AppConfig> jobs;
+        std::string error;
+        if (!batch::readManifest(config.batchFile.c_str(), &jobs, &error))
+        {
+            std::printf("%s\n", error.c_str());
+            return EXIT_FAILURE;
+        }
+        return batch::render(jobs, config.threads, stdout) ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    if (config.cameraList || config.showInfo)
     {
-        std::printf("Could not open map file: %s\n", config.mapFile.c_str());
+        BspLoader::Info info;
+        if (!common::loadInfo(config.mapFile.c_str(), &info))
+        {
+            std::printf("Could not open map file: %s\n", config.mapFile.c_str());
+            return EXIT_FAILURE;
+        }
+
+        if (config.showInfo)
+        {
+            std::printf("%s\n", common::formatInfoAsJson(info).c_str());
+        }
+        else
+        {
+            std::printf("%lu\n", info.cameras.size());
+        }
+        return EXIT_SUCCESS;
+    }
+
+    // Progress goes to stderr when the image itself is written to stdout
+    std::FILE* messages = config.imageFile == AppConfig::STANDARD_OUTPUT ? stderr : stdout;
+
+    std::shared_ptr<Scene> scene = std::make_shared<Scene>();
+    if (!common::loadBSP(config.mapFile.c_str(), common::parseLoaderOptions(config), config.cacheFile, scene.get(), config.width, config.height))
+    {
+        std::fprintf(messages, "Could not open map file: %s\n", config.mapFile.c_str());
         return EXIT_FAILURE;
     }
 
     if (config.overrideAmbientLight)
     {
-        scene.lighting.ambient = config.ambientLight;
+        scene->lighting.ambient = config.ambientLight;
     }
 
-    if (config.cameraList)
+    int percentage = 0;
+    auto printProgress = [&](float progress)
     {
-        std::printf("%lu\n", scene.cameras.size());
-        return EXIT_SUCCESS;
+        int newPercentage = static_cast<int>(progress * 100.0f);
+        for (int step = percentage + 1; step <= newPercentage; ++step)
+        {
+            if ((step % 10) == 0)
+            {
+                std::fprintf(messages, "%3d%%\n", step);
+            }
+            else
+            {
+                std::fprintf(messages, ".");
+                std::fflush(messages);
+            }
+        }
+        percentage = math::max(percentage, newPercentage);
+    };
+
+    ModelAnimation animation;
+    const bool animated = !config.animation.empty();
+    if (animated)
+    {
+        std::string error;
+        if (!common::loadModelAnimation(config, &animation, &error))
+        {
+            std::fprintf(messages, "%s\n", error.c_str());
+            return EXIT_FAILURE;
+        }
+
+        const int missingModel = animation.findMissingModel(*scene);
+        if (missingModel >= 0)
+        {
+            std::fprintf(messages, "No model *%d in map file: %s\n", missingModel, config.mapFile.c_str());
+            return EXIT_FAILURE;
+        }
     }
 
-    RayTracer::Config traceConfig = common::parseRayTracerConfig(config);
-    BackgroundTracer engine(traceConfig);
+    std::vector<int> cameraIndices;
+    {
+        std::string error;
+        if (!common::resolveCameras(config, *scene, &cameraIndices, &error))
+        {
+            std::fprintf(messages, "%s\n", error.c_str());
+            return EXIT_FAILURE;
+        }
+    }
 
-    size_t cameraIdx = math::clamp<size_t>(config.cameraIdx, 0, scene.cameras.size() - 1);
-    engine.startTrace(scene, scene.cameras[cameraIdx]);
+    std::vector<Shot> shots;
+    if (!config.flythrough.empty() || animated)
+    {
+        CameraPath path;
+        std::string error;
+        if (!config.flythrough.empty() && !common::loadCameraPath(config, &path, &error))
+        {
+            std::fprintf(messages, "%s\n", error.c_str());
+            return EXIT_FAILURE;
+        }
 
-    std::printf("Starting tracing scene\n");
-    int percentage = 0;
-    do
+        // The first camera of the level lends its view angles, corrected for the aspect ratio.
+        // Without a flythrough the camera stands still and watches the models move.
+        const Camera& camera = scene->cameras[cameraIndices.front()];
+        const float duration = math::max(path.getDuration(), animation.getDuration());
+        const int frameCount = static_cast<int>(duration * config.frameRate) + 1;
+        for (int ii = 0; ii < frameCount; ++ii)
+        {
+            const float time = ii / static_cast<float>(config.frameRate);
+            shots.push_back({path.keys.empty() ? camera : path.sample(time, scene->cameras.front()), ii, time});
+        }
+    }
+    else
+    {
+        for (int cameraIdx : cameraIndices)
+        {
+            shots.push_back({scene->cameras[cameraIdx], cameraIdx, 0.0f});
+        }
+    }
+    const ModelAnimation* shotAnimation = animated ? &animation : nullptr;
+
+    if (config.stripHeight > 0)
     {
-        int newPercentage = static_cast<int>(engine.getProgress() * 100.0f);
-        if (percentage != newPercentage)
+        std::fprintf(messages, "Starting tracing scene in strips of %d rows\n", config.stripHeight);
+        Scheduler scheduler(config.threads);
+        const float shotCount = static_cast<float>(shots.size());
+        for (int ii = 0; ii < static_cast<int>(shots.size()); ++ii)
         {
-            for (int step = percentage + 1; step <= newPercentage; ++step)
+            const std::string filename = common::formatOutputPath(config.imageFile, shots[ii].number);
+            auto printShotProgress = [&](float progress) { printProgress((ii + progress) / shotCount); };
+            if (animated)
             {
-                if ((step % 10) == 0)
-                {
-                    std::printf("%3d%%\n", step);
-                }
-                else
-                {
-                    std::printf(".");
-                    std::fflush(stdout);
-                }
+                animation.apply(shots[ii].time, scene.get());
+            }
+            if (!traceInStrips(*scene, shots[ii].camera, config, filename.c_str(), &scheduler, printShotProgress))
+            {
+                std::fprintf(messages, "Could not write to file: %s\n", filename.c_str());
+                return EXIT_FAILURE;
             }
-            percentage = newPercentage;
         }
+        std::fprintf(messages, "Trace complete\n");
+        return EXIT_SUCCESS;
+    }
+
+    if (shots.size() > 1)
+    {
+        std::fprintf(messages, "Starting tracing scene from %lu viewpoints\n", shots.size());
+        if (!traceShots(scene.get(), shotAnimation, shots, config, printProgress))
+        {
+            std::fprintf(messages, "Could not write to file: %s\n", config.imageFile.c_str());
+            return EXIT_FAILURE;
+        }
+        std::fprintf(messages, "Trace complete\n");
+        return EXIT_SUCCESS;
+    }
+
+    if (animated)
+    {
+        animation.apply(shots.front().time, scene.get());
+    }
+
+    const std::string imageFile = common::formatOutputPath(config.imageFile, shots.front().number);
+    RayTracer::Config traceConfig = common::parseRayTracerConfig(config);
+    BackgroundTracer engine(traceConfig);
+
+    // TGA rows are written as soon as they are traced, so writing the file overlaps with rendering.
+    // Other formats are encoded in one go once the trace is complete.
+    std::unique_ptr<targa::FileWriter> writer;
+    if (config.imageFormat == AppConfig::IMAGE_TGA)
+    {
+        writer.reset(new targa::FileWriter(common::createTGAWriter(engine.getCanvas(), imageFile.c_str(), common::parseCompression(config))));
+        if (!writer->isValid())
+        {
+            std::fprintf(messages, "Could not write to file: %s\n", imageFile.c_str());
+            return EXIT_FAILURE;
+        }
+    }
+    auto isRowFinished = [&engine](int row) { return engine.isRowFinished(row); };
+
+    engine.startTrace(scene, shots.front().camera);
+
+    std::fprintf(messages, "Starting tracing scene\n");
+    do
+    {
+        printProgress(engine.getProgress());
+        if (writer) { writer->writeFinishedRows(isRowFinished); }
         std::this_thread::yield();
     } while (engine.isTracing());
 
-    std::printf("Trace complete\n");
+    std::fprintf(messages, "Trace complete\n");
+
+    bool written;
+    if (writer)
+    {
+        writer->writeRemainingRows();
+        written = writer->isValid();
+    }
+    else
+    {
+        written = common::writeImage(engine.getCanvas(), imageFile.c_str(), config);
+    }
 
-    if (!common::writeToTGA(engine.getCanvas(), config.imageFile.c_str()))
+    if (!written)
     {
-        std::printf("Could not write to file: %s\n", config.imageFile.c_str());
+        std::fprintf(messages, "Could not write to file: %s\n", imageFile.c_str());
         return EXIT_FAILURE;
     }
 
@@ -0,0 +1,109 @@
+#include "File.hpp"
+
+#if TARGET_WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+File File::openStdOut()
+{
+    std::fflush(stdout);
+#if TARGET_WIN32
+    const int fd = _dup(_fileno(stdout));
+    if (fd < 0) { return File(); }
+    _setmode(fd, _O_BINARY);
+    FILE* fptr = _fdopen(fd, "wb");
+    if (!fptr) { _close(fd); }
+#else
+    const int fd = dup(fileno(stdout));
+    if (fd < 0) { return File(); }
+    FILE* fptr = fdopen(fd, "wb");
+    if (!fptr) { close(fd); }
+#endif
+    return File(fptr);
+}
+
+FileMapping FileMapping::open(const char* filename)
+{
+    FileMapping mapping;
+#if TARGET_WIN32
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) { return mapping; }
+    LARGE_INTEGER fileSize;
+    if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0)
+    {
+        HANDLE section = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (section)
+        {
+            void* view = MapViewOfFile(section, FILE_MAP_READ, 0, 0, 0);
+            if (view)
+            {
+                mapping.data = view;
+                mapping.length = static_cast<size_t>(fileSize.QuadPart);
+                mapping.handle = section;
+            }
+            else
+            {
+                // Without a view the read fallback below owns data, release() must not unmap it
+                CloseHandle(section);
+            }
+        }
+    }
+    CloseHandle(file);
+#else
+    const int fd = ::open(filename, O_RDONLY);
+    if (fd < 0) { return mapping; }
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0)
+    {
+        void* address = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (address != MAP_FAILED)
+        {
+            mapping.data = address;
+            mapping.length = static_cast<size_t>(info.st_size);
+            mapping.handle = address;
+        }
+    }
+    close(fd);
+#endif
+
+    if (!mapping.isValid())
+    {
+        // Mapping failed (empty file, special file system, ...), read the contents instead
+        File file = File::open(filename);
+        if (file.isValid())
+        {
+            mapping.buffer.resize(file.size());
+            if (!mapping.buffer.empty() && file.read(mapping.buffer.data(), mapping.buffer.size()) == 1)
+            {
+                mapping.data = mapping.buffer.data();
+                mapping.length = mapping.buffer.size();
+            }
+        }
+    }
+    return mapping;
+}
+
+void FileMapping::release()
+{
+    if (handle)
+    {
+#if TARGET_WIN32
+        UnmapViewOfFile(data);
+        CloseHandle(static_cast<HANDLE>(handle));
+#else
+        munmap(handle, length);
+#endif
+    }
+    data = nullptr;
+    length = 0;
+    handle = nullptr;
+    buffer.clear();
+}
@@ -19,13 +19,14 @@ public:
         ORIGIN_END = SEEK_END,
     };
     ~File() { if (fptr) { fclose(fptr); } fptr = nullptr; }
-    File(File&& other) { std::swap(this->fptr, other.fptr); }
+    File(File&& other) : fptr(nullptr) { std::swap(this->fptr, other.fptr); }
     File(const File& other) = delete;
     File& operator=(const File& other) = delete;
     File& operator=(File&& other) { std::swap(this->fptr, other.fptr); return *this; }
 
     static File open(const char* filename);
     static File openW(const char* filename);
+    static File openStdOut(); // Binary stream on a duplicate of stdout, closing it leaves stdout open
 
     bool isValid() const { return fptr != nullptr; }
     size_t write(const void* data, size_t bytecount);
@@ -34,6 +35,41 @@ public:
     size_t size();
 };
 
+// Read-only view of a whole file, backed by a memory mapping so pages are only loaded once they are touched
+class FileMapping
+{
+    FileMapping() : data(nullptr), length(0), handle(nullptr) {}
+
+    const void* data;
+    size_t length;
+    void* handle;
+    std::vector<unsigned char> buffer; // Fallback when the platform cannot map the file
+
+    void release();
+
+public:
+    ~FileMapping() { release(); }
+    FileMapping(FileMapping&& other) : FileMapping() { swap(other); }
+    FileMapping(const FileMapping& other) = delete;
+    FileMapping& operator=(const FileMapping& other) = delete;
+    FileMapping& operator=(FileMapping&& other) { swap(other); return *this; }
+
+    static FileMapping open(const char* filename);
+
+    bool isValid() const { return data != nullptr; }
+    const void* getData() const { return data; }
+    size_t size() const { return length; }
+
+private:
+    void swap(FileMapping& other)
+    {
+        std::swap(data, other.data);
+        std::swap(length, other.length);
+        std::swap(handle, other.handle);
+        buffer.swap(other.buffer);
+    }
+};
+
 inline File File::open(const char* filename)
 {
     FILE* fptr = fopen(filename, "rb");
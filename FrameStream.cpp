@@ -0,0 +1,100 @@
+#include "FrameStream.hpp"
+#include "Image.hpp"
+#include "Assert.hpp"
+#include <cstdio>
+#include <algorithm>
+
+// Reference: https://wiki.multimedia.cx/index.php/YUV4MPEG2
+namespace {
+    static const char Y4M_FRAME_HEADER[] = "FRAME\n";
+
+    // BT.601 limited range, the default ffmpeg assumes for Y4M input
+    inline std::uint8_t calcLuma(int r, int g, int b) { return static_cast<std::uint8_t>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16); }
+    inline std::uint8_t calcBlueDifference(int r, int g, int b) { return static_cast<std::uint8_t>(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128); }
+    inline std::uint8_t calcRedDifference(int r, int g, int b) { return static_cast<std::uint8_t>(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128); }
+}
+
+FrameStream::FrameStream(File&& file, Format format, int width, int height, int frameRate)
+: file(std::move(file))
+, format(format)
+, width(width)
+, height(height)
+, failed(false)
+{
+    if (format == FORMAT_Y4M && this->file.isValid())
+    {
+        char header[128];
+        const int length = std::snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", width, height, frameRate);
+        failed = this->file.write(header, length) != 1;
+    }
+}
+
+void FrameStream::writeFrame(const Image& image)
+{
+    ASSERT(image.width == width && image.height == height);
+    ASSERT(image.format == Image::FORMAT_ARGB); // Only ARGB is supported
+    if (!isValid()) { return; }
+
+    const int pixelCount = width * height;
+    const int pixelSize = image.getPixelSize();
+    const int red = image.getChannelOffset(Image::RED);
+    const int green = image.getChannelOffset(Image::GREEN);
+    const int blue = image.getChannelOffset(Image::BLUE);
+    const std::uint8_t* pixels = image.pixels.data();
+
+    if (format == FORMAT_BGRA)
+    {
+        convertToBGRA(image);
+    }
+    else
+    {
+        // One frame header followed by the Y, U and V planes
+        const int headerSize = sizeof(Y4M_FRAME_HEADER) - 1;
+        buffer.resize(headerSize + pixelCount * 3);
+        std::copy(Y4M_FRAME_HEADER, Y4M_FRAME_HEADER + headerSize, buffer.begin());
+        std::uint8_t* luma = buffer.data() + headerSize;
+        std::uint8_t* blueDifference = luma + pixelCount;
+        std::uint8_t* redDifference = blueDifference + pixelCount;
+        for (int ii = pixelCount - 1; ii >= 0; --ii)
+        {
+            const std::uint8_t* src = pixels + ii * pixelSize;
+            luma[ii] = calcLuma(src[red], src[green], src[blue]);
+            blueDifference[ii] = calcBlueDifference(src[red], src[green], src[blue]);
+            redDifference[ii] = calcRedDifference(src[red], src[green], src[blue]);
+        }
+    }
+
+    failed = file.write(buffer.data(), buffer.size()) != 1;
+}
+
+void FrameStream::writeRows(const Image& strip)
+{
+    ASSERT(format == FORMAT_BGRA && strip.width == width);
+    ASSERT(strip.format == Image::FORMAT_ARGB); // Only ARGB is supported
+    if (!isValid()) { return; }
+
+    convertToBGRA(strip);
+    failed = file.write(buffer.data(), buffer.size()) != 1;
+}
+
+void FrameStream::convertToBGRA(const Image& image)
+{
+    const int pixelCount = image.width * image.height;
+    const int pixelSize = image.getPixelSize();
+    const int red = image.getChannelOffset(Image::RED);
+    const int green = image.getChannelOffset(Image::GREEN);
+    const int blue = image.getChannelOffset(Image::BLUE);
+    const int alpha = image.getChannelOffset(Image::ALPHA);
+    const std::uint8_t* pixels = image.pixels.data();
+
+    buffer.resize(pixelCount * 4);
+    for (int ii = pixelCount - 1; ii >= 0; --ii)
+    {
+        const std::uint8_t* src = pixels + ii * pixelSize;
+        std::uint8_t* dst = buffer.data() + ii * 4;
+        dst[0] = src[blue];
+        dst[1] = src[green];
+        dst[2] = src[red];
+        dst[3] = src[alpha];
+    }
+}
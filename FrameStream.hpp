@@ -0,0 +1,37 @@
+#pragma once
+
+#include "File.hpp"
+#include <vector>
+#include <cstdint>
+
+struct Image;
+
+// Writes a sequence of equally sized frames to a file or pipe, so a video encoder can consume them while rendering continues
+class FrameStream
+{
+public:
+    enum Format
+    {
+        FORMAT_Y4M,     // YUV4MPEG2 with full resolution chroma, understood by ffmpeg without further arguments
+        FORMAT_BGRA,    // Raw 8-bit BGRA rows from the top down, the reader has to know the size and rate
+    };
+
+    static const int DEFAULT_FRAME_RATE = 30;
+
+    FrameStream(File&& file, Format format, int width, int height, int frameRate = DEFAULT_FRAME_RATE);
+
+    bool isValid() const { return file.isValid() && !failed; }
+    void writeFrame(const Image& image);
+    // Raw BGRA frames have no header, so a frame can also be written as consecutive strips of rows
+    void writeRows(const Image& strip);
+
+private:
+    void convertToBGRA(const Image& image);
+
+    File file;
+    Format format;
+    int width;
+    int height;
+    bool failed;
+    std::vector<std::uint8_t> buffer; // Reused for every frame
+};
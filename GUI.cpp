@@ -63,6 +63,26 @@ int GUI::runUntilFinished(int argc, char const * const * const argv)
         }
     }
 
+    if (config.cameraList || config.showInfo)
+    {
+        BspLoader::Info info;
+        if (!common::loadInfo(config.mapFile.c_str(), &info))
+        {
+            SDL_Log("Could not open map file: %s", config.mapFile.c_str());
+            return EXIT_FAILURE;
+        }
+
+        if (config.showInfo)
+        {
+            SDL_Log("%s", common::formatInfoAsJson(info).c_str());
+        }
+        else
+        {
+            SDL_Log("%lu", info.cameras.size());
+        }
+        return EXIT_SUCCESS;
+    }
+
     SDL_Init(SDL_INIT_VIDEO);
 
     SDL_Window *window = SDL_CreateWindow("QuakeTrace", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, config.width, config.height, 0);
@@ -75,11 +95,11 @@ int GUI::runUntilFinished(int argc, char const * const * const argv)
     auto fb = FrameBuffer::createFromWindow(window);
 
     auto font = Font::create();
-    Scene scene;
+    std::shared_ptr<Scene> scene = std::make_shared<Scene>();
 #if DEFAULT_SCENE
-    Scene::initDefault(&scene);
+    Scene::initDefault(scene.get());
 #else
-    if (!common::loadBSP(config.mapFile.c_str(), &scene, config.width, config.height))
+    if (!common::loadBSP(config.mapFile.c_str(), common::parseLoaderOptions(config), config.cacheFile, scene.get(), config.width, config.height))
     {
         SDL_Log("Could not open map file: %s", config.mapFile.c_str());
         return EXIT_FAILURE;
@@ -88,13 +108,7 @@ int GUI::runUntilFinished(int argc, char const * const * const argv)
 
     if (config.overrideAmbientLight)
     {
-        scene.lighting.ambient = config.ambientLight;
-    }
-
-    if (config.cameraList)
-    {
-        SDL_Log("%lu", scene.cameras.size());
-        return EXIT_SUCCESS;
+        scene->lighting.ambient = config.ambientLight;
     }
 
     RayTracer::Config traceConfig = common::parseRayTracerConfig(config);
@@ -139,8 +153,8 @@ int GUI::runUntilFinished(int argc, char const * const * const argv)
         if (refreshCanvas)
         {
             renderStart = SDL_GetTicks();
-            size_t cameraIdx = math::clamp<size_t>(config.cameraIdx, 0, scene.cameras.size() - 1);
-            engine.startTrace(scene, scene.cameras[cameraIdx]);
+            size_t cameraIdx = math::clamp<size_t>(config.cameraIdx, 0, scene->cameras.size() - 1);
+            engine.startTrace(scene, scene->cameras[cameraIdx]);
 
             refreshCanvas = false;
         }
@@ -155,9 +169,11 @@ int GUI::runUntilFinished(int argc, char const * const * const argv)
         if (!engine.isTracing() && wasTracing)
         {
             renderTime = SDL_GetTicks() - renderStart;
-            if (!common::writeToTGA(engine.getCanvas(), config.imageFile.c_str()))
+            const int cameraIdx = math::clamp<int>(config.cameraIdx, 0, util::lastIndex(scene->cameras));
+            const std::string imageFile = common::formatOutputPath(config.imageFile, cameraIdx);
+            if (!common::writeImage(engine.getCanvas(), imageFile.c_str(), config))
             {
-                SDL_Log("Could not write to file: %s", config.imageFile.c_str());
+                SDL_Log("Could not write to file: %s", imageFile.c_str());
                 return EXIT_FAILURE;
             }
         }
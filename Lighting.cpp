@@ -15,7 +15,7 @@ inline float applyAngleScale(float value)
 }
 
 template<typename T>
-float calcLightingForLightType(const std::vector<T>& lights, const Scene& scene, const math::Vec3f& origin, const math::Vec3f& hitNormal, int softShadowRays, bool selfShadow)
+float calcLightingForLightType(const std::vector<T>& lights, const SceneView& scene, const math::Vec3f& origin, const math::Vec3f& hitNormal, int softShadowRays, bool selfShadow, RayCount* rayCount)
 {
     float lightLevel = 0.0f;
     for (int ii = util::lastIndex(lights); ii >= 0; --ii)
@@ -31,6 +31,7 @@ float calcLightingForLightType(const std::vector<T>& lights, const Scene& scene,
         auto lightRays = light.getRandomLightPoints(castRay, softShadowRays);
         lightRays.push_back(light.origin);
         const float rayContribution = 1.0f / lightRays.size();
+        rayCount->shadow += lightRays.size();
         for (int ii = util::lastIndex(lightRays); ii >= 0; --ii )
         {
             auto lightOrigin = lightRays[ii];
@@ -48,13 +49,14 @@ float calcLightingForLightType(const std::vector<T>& lights, const Scene& scene,
     return lightLevel;
 }
 
-const float Lighting::calcLightLevel(const math::Vec3f& origin, const math::Vec3f& hitNormal, const Scene& scene, int softShadowRays, int occlusionRays, int occlusionRayStrength, bool selfShadow) const
+const float Lighting::calcLightLevel(const math::Vec3f& origin, const math::Vec3f& hitNormal, const SceneView& scene, int softShadowRays, int occlusionRays, int occlusionRayStrength, bool selfShadow, RayCount* rayCount) const
 {
     float lightLevel = ambient;
     for (int ii = util::lastIndex(directional); ii >= 0; --ii)
     {
         const Directional& light = directional[ii];
         Ray lightRay{ origin, -light.normal };
+        ++rayCount->shadow;
         if (!collision3d::raySceneCollision(lightRay, DIRECTIONAL_RAY_LENGTH, scene))
         {
             const float factor = light.calcContribution(hitNormal, lightRay.dir);
@@ -62,14 +64,15 @@ const float Lighting::calcLightLevel(const math::Vec3f& origin, const math::Vec3
         }
     }
 
-    lightLevel += calcLightingForLightType<Point>(points, scene, origin, hitNormal, softShadowRays, selfShadow);
-    lightLevel += calcLightingForLightType<Spot>(spots, scene, origin, hitNormal, softShadowRays, selfShadow);
+    lightLevel += calcLightingForLightType<Point>(points, scene, origin, hitNormal, softShadowRays, selfShadow, rayCount);
+    lightLevel += calcLightingForLightType<Spot>(spots, scene, origin, hitNormal, softShadowRays, selfShadow, rayCount);
     lightLevel = math::clamp(lightLevel, 0.0f, 2.0f);
 
     if (lightLevel > 0.0f && occlusionRays > 0 && occlusionRayStrength > 0)
     {
         std::vector<math::Vec3f> occlusion = getPointsOnUnitSphere(occlusionRays);
         int occlusionHits = 0;
+        rayCount->occlusion += occlusion.size();
         for (int ii = util::lastIndex(occlusion); ii >= 0; --ii)
         {
             auto& dir = occlusion[ii];
@@ -7,5 +7,6 @@
 #else
 #include <cstdio>
 
-#define LOG std::printf
+// Diagnostics go to stderr, stdout may carry image data
+#define LOG(...) std::fprintf(stderr, __VA_ARGS__)
 #endif
@@ -0,0 +1,143 @@
+#include "ModelAnimation.hpp"
+#include "Scene.hpp"
+#include "Math.hpp"
+#include "Util.hpp"
+#include <cstdlib>
+
+namespace {
+    static const char COMMENT_PREFIX = '#';
+    static const int KEY_FIELD_COUNT = 5;
+}
+
+bool ModelAnimation::parse(const char* text, size_t length, ModelAnimation* animation, std::string* error)
+{
+    const char* textEnd = text + length;
+    int lineNumber = 0;
+    for (const char* line = text; line < textEnd; )
+    {
+        const char* lineEnd = line;
+        while (lineEnd < textEnd && *lineEnd != '\n') { ++lineEnd; }
+        const std::string content(line, lineEnd);
+        line = lineEnd + 1;
+        ++lineNumber;
+
+        const size_t first = content.find_first_not_of(" \t\r");
+        if (first == std::string::npos || content[first] == COMMENT_PREFIX)
+        {
+            continue;
+        }
+
+        float values[KEY_FIELD_COUNT];
+        const char* field = content.c_str();
+        for (int ii = 0; ii < KEY_FIELD_COUNT; ++ii)
+        {
+            char* fieldEnd;
+            values[ii] = std::strtof(field, &fieldEnd);
+            if (fieldEnd == field)
+            {
+                *error = "Line " + std::to_string(lineNumber) + ": expected time model x y z";
+                return false;
+            }
+            field = fieldEnd;
+        }
+
+        const Key key = {values[0], static_cast<int>(values[1]), {values[2], values[3], values[4]}};
+        if (key.levelModel < 0 || key.levelModel != values[1])
+        {
+            *error = "Line " + std::to_string(lineNumber) + ": model has to be a model number like the 3 of *3";
+            return false;
+        }
+        for (int ii = util::lastIndex(animation->keys); ii >= 0; --ii)
+        {
+            const Key& previous = animation->keys[ii];
+            if (previous.levelModel != key.levelModel) { continue; }
+            if (key.time < previous.time)
+            {
+                *error = "Line " + std::to_string(lineNumber) + ": keys of a model have to be ordered by time";
+                return false;
+            }
+            break;
+        }
+        animation->keys.push_back(key);
+    }
+
+    if (animation->keys.empty())
+    {
+        *error = "No keys in model animation";
+        return false;
+    }
+    return true;
+}
+
+float ModelAnimation::getDuration() const
+{
+    float duration = 0.0f;
+    for (int ii = util::lastIndex(keys); ii >= 0; --ii)
+    {
+        duration = math::max(duration, keys[ii].time);
+    }
+    return duration;
+}
+
+int ModelAnimation::findMissingModel(const Scene& scene) const
+{
+    for (int ii = util::lastIndex(keys); ii >= 0; --ii)
+    {
+        bool found = false;
+        for (int jj = util::lastIndex(scene.models); jj >= 0 && !found; --jj)
+        {
+            found = scene.models[jj].levelModel == keys[ii].levelModel;
+        }
+        if (!found)
+        {
+            return keys[ii].levelModel;
+        }
+    }
+    return -1;
+}
+
+bool ModelAnimation::sample(int levelModel, float time, math::Vec3f* offset) const
+{
+    const Key* previous = nullptr;
+    const Key* next = nullptr;
+    for (const Key& key : keys)
+    {
+        if (key.levelModel != levelModel) { continue; }
+        if (key.time <= time) { previous = &key; }
+        else if (!next) { next = &key; }
+    }
+
+    if (!previous && !next)
+    {
+        return false;
+    }
+
+    // Before the first and after the last key the model rests at that key
+    if (!previous || !next)
+    {
+        *offset = previous ? previous->offset : next->offset;
+        return true;
+    }
+
+    const float t = (time - previous->time) / (next->time - previous->time);
+    *offset = previous->offset + (next->offset - previous->offset) * t;
+    return true;
+}
+
+void ModelAnimation::apply(float time, Scene* scene) const
+{
+    for (int ii = util::lastIndex(scene->instances); ii >= 0; --ii)
+    {
+        const int levelModel = scene->models[scene->instances[ii].model].levelModel;
+        math::Vec3f offset;
+        if (levelModel < 0 || !sample(levelModel, time, &offset))
+        {
+            continue;
+        }
+
+        if (offset != scene->instances[ii].origin)
+        {
+            scene->moveInstance(ii, offset);
+        }
+    }
+}
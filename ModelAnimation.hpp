@@ -0,0 +1,35 @@
+#pragma once
+
+#include "Vec3.hpp"
+#include <vector>
+#include <string>
+#include <cstddef>
+
+struct Scene;
+
+// Keyframed offsets of level models, like doors, platforms and trains moving between frames
+struct ModelAnimation
+{
+    struct Key
+    {
+        float time; // Seconds since the start of the animation
+        int levelModel; // The N of a *N model key
+        math::Vec3f offset; // From where the level places the model
+    };
+
+    std::vector<Key> keys; // Ordered by time for every model
+
+    // One "time model x y z" key per line. Empty lines and lines starting with # are skipped.
+    static bool parse(const char* text, size_t length, ModelAnimation* animation, std::string* error);
+
+    float getDuration() const;
+    // Level model number of a key without a model in the scene, -1 when all of them are there
+    int findMissingModel(const Scene& scene) const;
+    // Moves every instance of an animated model to its place at the given time and refits the scene hierarchy in place,
+    // nothing may trace the scene meanwhile. Level models are loaded in place, so an offset is also the instance origin.
+    void apply(float time, Scene* scene) const;
+
+private:
+    // Offset interpolated linearly between the keys of a model, false when the model has no keys
+    bool sample(int levelModel, float time, math::Vec3f* offset) const;
+};
@@ -0,0 +1,86 @@
+#include "PakFile.hpp"
+#include "Util.hpp"
+#include "Assert.hpp"
+#include <cstdint>
+#include <cstring>
+#include <cctype>
+
+namespace {
+    static const char PAK_MAGIC[] = { 'P', 'A', 'C', 'K' };
+    static const char PAK_EXTENSION[] = ".pak";
+
+    struct Header
+    {
+        char magic[4];
+        int32_t directoryOffset;
+        int32_t directorySize;
+    };
+
+    struct DirectoryEntry
+    {
+        char name[56];
+        int32_t offset;
+        int32_t size;
+    };
+
+    inline bool isRangeInside(int64_t offset, int64_t size, int64_t containerSize)
+    {
+        return offset >= 0 && size >= 0 && offset <= containerSize && size <= containerSize - offset;
+    }
+
+    bool endsWithExtension(const std::string& path, size_t end)
+    {
+        const size_t length = sizeof(PAK_EXTENSION) - 1;
+        if (end < length) { return false; }
+        for (size_t ii = 0; ii < length; ++ii)
+        {
+            if (std::tolower(static_cast<unsigned char>(path[end - length + ii])) != PAK_EXTENSION[ii]) { return false; }
+        }
+        return true;
+    }
+}
+
+bool PakFile::splitPath(const std::string& path, std::string* archive, std::string* entry)
+{
+    // Search for the separator right after the extension, drive letters also contain a colon
+    for (size_t separator = path.find(':'); separator != std::string::npos; separator = path.find(':', separator + 1))
+    {
+        if (endsWithExtension(path, separator) && separator + 1 < path.size())
+        {
+            *archive = path.substr(0, separator);
+            *entry = path.substr(separator + 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+PakFile PakFile::open(const char* filename)
+{
+    PakFile pak(FileMapping::open(filename));
+    if (!pak.mapping.isValid() || pak.mapping.size() < sizeof(Header)) { return pak; }
+
+    auto& header = *util::castFromMemory<Header>(pak.mapping.getData());
+    pak.valid = !std::memcmp(header.magic, PAK_MAGIC, sizeof(PAK_MAGIC))
+        && isRangeInside(header.directoryOffset, header.directorySize, pak.mapping.size());
+    return pak;
+}
+
+bool PakFile::find(const char* name, Entry* entry) const
+{
+    ASSERT(isValid());
+    auto& header = *util::castFromMemory<Header>(mapping.getData());
+    auto directory = util::castFromMemory<DirectoryEntry>(mapping.getData(), header.directoryOffset);
+    const int entryCount = header.directorySize / sizeof(DirectoryEntry);
+    for (int ii = 0; ii < entryCount; ++ii)
+    {
+        const DirectoryEntry& dirEntry = directory[ii];
+        if (std::strncmp(dirEntry.name, name, sizeof(dirEntry.name))) { continue; }
+        if (!isRangeInside(dirEntry.offset, dirEntry.size, mapping.size())) { return false; }
+
+        entry->data = util::castFromMemory<char>(mapping.getData(), dirEntry.offset);
+        entry->size = dirEntry.size;
+        return true;
+    }
+    return false;
+}
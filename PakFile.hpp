@@ -0,0 +1,29 @@
+#pragma once
+
+#include "File.hpp"
+#include <cstddef>
+#include <string>
+
+// Quake PAK archive. The archive is mapped once and entries are handed out as views into the mapping,
+// so they stay valid for as long as the PakFile is alive.
+class PakFile
+{
+    PakFile(FileMapping&& mapping) : mapping(std::move(mapping)), valid(false) {}
+
+    FileMapping mapping;
+    bool valid;
+
+public:
+    struct Entry
+    {
+        const void* data;
+        size_t size;
+    };
+
+    // Splits "archive.pak:maps/e1m1.bsp" into its archive and entry parts, fails for plain file names
+    static bool splitPath(const std::string& path, std::string* archive, std::string* entry);
+    static PakFile open(const char* filename);
+
+    bool isValid() const { return valid; }
+    bool find(const char* name, Entry* entry) const;
+};
@@ -0,0 +1,272 @@
+#include "Qoi.hpp"
+#include "Image.hpp"
+#include "Scheduler.hpp"
+#include "Assert.hpp"
+#include <cstring>
+
+namespace {
+    static const std::uint8_t MAGIC[] = { 'q', 'o', 'i', 'f' };
+    static const std::uint8_t CHANNELS_RGBA = 4;
+    static const std::uint8_t COLORSPACE_SRGB = 0;
+    static const std::uint8_t END_MARKER[] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+
+    static const std::uint8_t OP_INDEX = 0x00;
+    static const std::uint8_t OP_DIFF = 0x40;
+    static const std::uint8_t OP_LUMA = 0x80;
+    static const std::uint8_t OP_RUN = 0xc0;
+    static const std::uint8_t OP_RGB = 0xfe;
+    static const std::uint8_t OP_RGBA = 0xff;
+
+    static const int INDEX_SIZE = 64;
+    static const int MAX_RUN_LENGTH = 62;
+    static const int CHUNK_PIXEL_COUNT = 64 * 1024;
+    static const int MAX_CHUNK_SIZE = 5; // Worst case bytes per pixel, an RGBA op
+
+    struct Pixel
+    {
+        std::uint8_t r, g, b, a;
+
+        bool operator==(const Pixel& other) const { return r == other.r && g == other.g && b == other.b && a == other.a; }
+        bool operator!=(const Pixel& other) const { return !(*this == other); }
+    };
+
+    inline int hash(const Pixel& px)
+    {
+        return (px.r * 3 + px.g * 5 + px.b * 7 + px.a * 11) % INDEX_SIZE;
+    }
+}
+
+// Encoder state at a pixel, the previous pixel and the index of recently seen ones
+
+struct qoi::State
+{
+    Pixel previous;
+    Pixel index[INDEX_SIZE];
+    int run; // Pixels of a run that is still open, it may continue into the next strip
+    std::int64_t position; // Pixels encoded before, chunk borders are counted from the first pixel of the image
+};
+
+namespace {
+    struct ChunkInput
+    {
+        int first;
+        int count;
+        int output;
+        bool closesRun; // Ends at a chunk border or at the last pixel of the image
+        qoi::State state;
+    };
+
+    struct ChunkContext
+    {
+        const std::vector<Pixel>& pixels;
+        std::vector<qoi::Buffer>* outputs;
+
+        void process(const ChunkInput& chunk) const;
+    };
+
+    void ChunkContext::process(const ChunkInput& chunk) const
+    {
+        qoi::Buffer& output = (*outputs)[chunk.output];
+        output.resize(chunk.count * MAX_CHUNK_SIZE);
+        std::uint8_t* bytes = output.data();
+
+        qoi::State state = chunk.state;
+        int run = state.run;
+        const int end = chunk.first + chunk.count;
+        for (int ii = chunk.first; ii < end; ++ii)
+        {
+            const Pixel& px = pixels[ii];
+            if (px == state.previous)
+            {
+                ++run;
+                if (run == 1)
+                {
+                    // The decoder stores the pixel of a run as well, which keeps the index equal to the one at chunk borders
+                    state.index[hash(px)] = px;
+                }
+                // Runs are cut at chunk borders, the next chunk simply starts a new one
+                if (run == MAX_RUN_LENGTH || (chunk.closesRun && ii == end - 1))
+                {
+                    *bytes++ = OP_RUN | (run - 1);
+                    run = 0;
+                }
+                continue;
+            }
+
+            if (run > 0)
+            {
+                *bytes++ = OP_RUN | (run - 1);
+                run = 0;
+            }
+
+            const int indexPos = hash(px);
+            if (state.index[indexPos] == px)
+            {
+                *bytes++ = OP_INDEX | indexPos;
+            }
+            else
+            {
+                state.index[indexPos] = px;
+                if (px.a == state.previous.a)
+                {
+                    const int dr = static_cast<std::int8_t>(px.r - state.previous.r);
+                    const int dg = static_cast<std::int8_t>(px.g - state.previous.g);
+                    const int db = static_cast<std::int8_t>(px.b - state.previous.b);
+                    const int dgr = dr - dg;
+                    const int dgb = db - dg;
+                    if (dr > -3 && dr < 2 && dg > -3 && dg < 2 && db > -3 && db < 2)
+                    {
+                        *bytes++ = OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+                    }
+                    else if (dgr > -9 && dgr < 8 && dg > -33 && dg < 32 && dgb > -9 && dgb < 8)
+                    {
+                        *bytes++ = OP_LUMA | (dg + 32);
+                        *bytes++ = (dgr + 8) << 4 | (dgb + 8);
+                    }
+                    else
+                    {
+                        *bytes++ = OP_RGB;
+                        *bytes++ = px.r;
+                        *bytes++ = px.g;
+                        *bytes++ = px.b;
+                    }
+                }
+                else
+                {
+                    *bytes++ = OP_RGBA;
+                    *bytes++ = px.r;
+                    *bytes++ = px.g;
+                    *bytes++ = px.b;
+                    *bytes++ = px.a;
+                }
+            }
+            state.previous = px;
+        }
+        output.resize(bytes - output.data());
+    }
+
+    void writeBigEndian(qoi::Buffer* output, std::uint32_t value)
+    {
+        output->push_back(static_cast<std::uint8_t>(value >> 24));
+        output->push_back(static_cast<std::uint8_t>(value >> 16));
+        output->push_back(static_cast<std::uint8_t>(value >> 8));
+        output->push_back(static_cast<std::uint8_t>(value));
+    }
+
+    void writeHeader(qoi::Buffer* output, std::uint32_t width, std::uint32_t height)
+    {
+        output->insert(output->end(), MAGIC, MAGIC + sizeof(MAGIC));
+        writeBigEndian(output, width);
+        writeBigEndian(output, height);
+        output->push_back(CHANNELS_RGBA);
+        output->push_back(COLORSPACE_SRGB);
+    }
+
+    void resetState(qoi::State* state)
+    {
+        std::memset(state, 0, sizeof(*state));
+        state->previous = {0, 0, 0, 255};
+    }
+
+    // Appends the encoded pixels of the image to output, the state carries over from and to the neighbouring pixels.
+    // Chunks are cut at the same pixels whether the image is encoded at once or strip by strip, and a run only ends
+    // at a chunk border or after the last pixel, so both give the same bytes.
+    void encodePixels(const Image& image, bool lastPixels, qoi::State* state, Scheduler* scheduler, qoi::Buffer* output)
+    {
+        ASSERT(image.format == Image::FORMAT_ARGB); // Only ARGB is supported
+        const int pixelCount = image.width * image.height;
+        const int pixelSize = image.getPixelSize();
+        const int red = image.getChannelOffset(Image::RED);
+        const int green = image.getChannelOffset(Image::GREEN);
+        const int blue = image.getChannelOffset(Image::BLUE);
+        const int alpha = image.getChannelOffset(Image::ALPHA);
+
+        std::vector<Pixel> pixels(pixelCount);
+        for (int ii = pixelCount - 1; ii >= 0; --ii)
+        {
+            const std::uint8_t* src = image.pixels.data() + ii * pixelSize;
+            pixels[ii] = {src[red], src[green], src[blue], src[alpha]};
+        }
+
+        // The decoder stores every pixel it produces in the index, so the state at a chunk border
+        // follows from a single cheap pass, without encoding anything before it
+        std::vector<ChunkInput> chunks;
+        for (int first = 0; first < pixelCount; )
+        {
+            const int chunkLeft = CHUNK_PIXEL_COUNT - static_cast<int>(state->position % CHUNK_PIXEL_COUNT);
+            const int count = pixelCount - first < chunkLeft ? pixelCount - first : chunkLeft;
+            const bool closesRun = count == chunkLeft || (lastPixels && first + count == pixelCount);
+            chunks.push_back({first, count, static_cast<int>(chunks.size()), closesRun, *state});
+            for (int ii = first; ii < first + count; ++ii)
+            {
+                const Pixel& px = pixels[ii];
+                state->run = px == state->previous ? (state->run + 1) % MAX_RUN_LENGTH : 0;
+                state->index[hash(px)] = px;
+                state->previous = px;
+            }
+            if (closesRun) { state->run = 0; }
+            state->position += count;
+            first += count;
+        }
+
+        std::vector<qoi::Buffer> outputs(chunks.size());
+        ChunkContext context = {pixels, &outputs};
+        if (scheduler && chunks.size() > 1)
+        {
+            scheduler->schedule<ChunkInput, ChunkContext>(chunks, context);
+        }
+        else
+        {
+            for (const auto& chunk : chunks) { context.process(chunk); }
+        }
+
+        for (const auto& chunkOutput : outputs)
+        {
+            output->insert(output->end(), chunkOutput.begin(), chunkOutput.end());
+        }
+    }
+}
+
+const qoi::Buffer qoi::encode(const Image& image, Scheduler* scheduler)
+{
+    Buffer buffer;
+    writeHeader(&buffer, image.width, image.height);
+    State state;
+    resetState(&state);
+    encodePixels(image, true, &state, scheduler, &buffer);
+    buffer.insert(buffer.end(), END_MARKER, END_MARKER + sizeof(END_MARKER));
+    return buffer;
+}
+
+qoi::FileWriter::FileWriter(File&& file, int width, int height)
+: file(std::move(file))
+, state(new State)
+, width(width)
+, remainingRows(height)
+, failed(false)
+{
+    resetState(state.get());
+    writeHeader(&buffer, width, height);
+    flush();
+}
+
+qoi::FileWriter::~FileWriter() = default;
+
+void qoi::FileWriter::writeRows(const Image& strip, Scheduler* scheduler)
+{
+    ASSERT(strip.width == width && strip.height <= remainingRows);
+    remainingRows -= strip.height;
+    encodePixels(strip, isComplete(), state.get(), scheduler, &buffer);
+    if (isComplete())
+    {
+        buffer.insert(buffer.end(), END_MARKER, END_MARKER + sizeof(END_MARKER));
+    }
+    flush();
+}
+
+void qoi::FileWriter::flush()
+{
+    if (buffer.empty() || !isValid()) { buffer.clear(); return; }
+    failed = file.write(buffer.data(), buffer.size()) != 1;
+    buffer.clear();
+}
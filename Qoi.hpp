@@ -0,0 +1,46 @@
+#pragma once
+
+#include "File.hpp"
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+struct Image;
+class Scheduler;
+
+// Reference: https://qoiformat.org/qoi-specification.pdf
+namespace qoi
+{
+    typedef std::vector<std::uint8_t> Buffer;
+
+    // The image is split into fixed size chunks that are encoded in parallel when a scheduler is given.
+    // Each chunk starts from the encoder state at its first pixel, so the output does not depend on the thread count.
+    const Buffer encode(const Image& image, Scheduler* scheduler = nullptr);
+
+    struct State;
+
+    // Writes an image to disk in strips of rows from the top down, so only the current strip has to be in memory.
+    // Width and height are stored as 32 bit, well past what fits in a TGA file. The file holds the same bytes as encode().
+    class FileWriter
+    {
+        File file;
+        std::unique_ptr<State> state;
+        int width;
+        int remainingRows;
+        bool failed;
+        Buffer buffer;
+
+    public:
+        FileWriter(File&& file, int width, int height);
+        ~FileWriter();
+
+        bool isValid() const { return file.isValid() && !failed; }
+        bool isComplete() const { return remainingRows == 0; }
+
+        // The end marker follows the last row
+        void writeRows(const Image& strip, Scheduler* scheduler = nullptr);
+
+    private:
+        void flush();
+    };
+};
@@ -1,9 +1,18 @@
 #pragma once
 
 #include "Vec3.hpp"
+#include <cstdint>
 
 struct Ray
 {
     math::Vec3f origin;
     math::Vec3f dir;
 };
+
+// Rays cast while tracing, by purpose
+struct RayCount
+{
+    std::uint64_t primary;
+    std::uint64_t shadow;
+    std::uint64_t occlusion;
+};
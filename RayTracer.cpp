@@ -5,6 +5,57 @@
 #include "Collision3D.hpp"
 #include "Scene.hpp"
 #include "BreakPoint.hpp"
+#include <cmath>
+
+namespace {
+    // Grazing angles stretch the footprint without bound, stop at the smallest mip level before that
+    static const float MIN_FOOTPRINT_COSINE = 0.05f;
+    // Reused light levels drift from the exact value as the reprojected spot moves within a pixel, refresh them now and then
+    static const int MAX_HISTORY_AGE = 8;
+    // Weight of a freshly calculated light level against the expired one it replaces
+    static const float HISTORY_BLEND = 0.5f;
+    // Distance in pixels between the reprojected spot and the one seen in the previous frame that still counts as the same
+    static const float REPROJECTION_TOLERANCE = 1.0f;
+
+    // Orientation of a cube map face, each axis given in the forward, right and up axes of the camera
+    struct CubeFace
+    {
+        math::Vec3f forward;
+        math::Vec3f right;
+        math::Vec3f up;
+    };
+
+    static const CubeFace CUBE_FACES[] = {
+        { { 1.0f, 0.0f, 0.0f}, { 0.0f, 1.0f, 0.0f}, { 0.0f, 0.0f, 1.0f} }, // Front
+        { { 0.0f, 1.0f, 0.0f}, {-1.0f, 0.0f, 0.0f}, { 0.0f, 0.0f, 1.0f} }, // Right
+        { {-1.0f, 0.0f, 0.0f}, { 0.0f,-1.0f, 0.0f}, { 0.0f, 0.0f, 1.0f} }, // Back
+        { { 0.0f,-1.0f, 0.0f}, { 1.0f, 0.0f, 0.0f}, { 0.0f, 0.0f, 1.0f} }, // Left
+        { { 0.0f, 0.0f, 1.0f}, { 0.0f, 1.0f, 0.0f}, {-1.0f, 0.0f, 0.0f} }, // Up
+        { { 0.0f, 0.0f,-1.0f}, { 0.0f, 1.0f, 0.0f}, { 1.0f, 0.0f, 0.0f} }, // Down
+    };
+    static const int CUBE_FACE_COUNT = sizeof(CUBE_FACES) / sizeof(CUBE_FACES[0]);
+
+    const math::Vec3f toWorld(const Camera& camera, const math::Vec3f& local)
+    {
+        return camera.direction * local.x + camera.right * local.y + camera.up * local.z;
+    }
+
+    // Same origin and heading, but looking at the horizon with the world up direction as up
+    const Camera levelCamera(const Camera& camera)
+    {
+        static const math::Vec3f UP{0.0f, 0.0f, 1.0f};
+        math::Vec3f heading{camera.direction.x, camera.direction.y, 0.0f};
+        if (math::length2(heading) <= 0.0f)
+        {
+            // Looking straight up or down, the top of the view points where the camera is headed
+            heading = {camera.up.x, camera.up.y, 0.0f};
+        }
+
+        Camera level = camera;
+        level.setPosition(camera.origin, math::normalized(heading), UP);
+        return level;
+    }
+}
 
 struct RayInput
 {
@@ -15,9 +66,11 @@ struct RayInput
 struct RayContext
 {
     Image* canvas;
-    const RayTracer& engine;
-    const Scene& scene;
-    const Scene& shadowScene;
+    int firstRow;
+    bool keepHistory;
+    RayTracer& engine;
+    const SceneView& view;
+    const SceneView& shadowView;
     const Camera& camera;
     const std::vector<math::Vec2f>& sampleOffsets;
 
@@ -32,22 +85,72 @@ void RayContext::process(RayInput in) const
     }
 
     Color aggregate(0.0f);
+    RayCount rayCount = {0, 0, 0};
+    RayTracer::HistoryEntry* history = keepHistory ? &engine.history[in.x + (in.y + firstRow) * engine.config.width] : nullptr;
 
     for (int ii = util::lastIndex(sampleOffsets); ii >= 0; --ii)
     {
         const float sampleX = in.x + sampleOffsets[ii].x;
-        const float sampleY = in.y + sampleOffsets[ii].y;
-        const float normX = (sampleX / static_cast<float>(canvas->width) - 0.5f) * 2.0f;
-        const float normY = (sampleY / static_cast<float>(canvas->height) - 0.5f) * -2.0f;
-        Color color = engine.renderPixel(scene, shadowScene, camera, normX, normY);
+        const float sampleY = in.y + firstRow + sampleOffsets[ii].y;
+        const float normX = (sampleX / static_cast<float>(engine.config.width) - 0.5f) * 2.0f;
+        const float normY = (sampleY / static_cast<float>(engine.config.height) - 0.5f) * -2.0f;
+        Color color = engine.renderPixel(view, shadowView, camera, normX, normY, history, &rayCount);
         aggregate += color / static_cast<float>(sampleOffsets.size());
     }
 
     uint32_t* pixel = reinterpret_cast<uint32_t*>(canvas->pixels.data() + in.pixelIdx);
     Color::normalize(&aggregate);
     *pixel = Color::asARGB(aggregate);
+    // Counted per pixel, the shared counters would be contended on every single ray otherwise
+    engine.primaryRays += rayCount.primary;
+    engine.shadowRays += rayCount.shadow;
+    engine.occlusionRays += rayCount.occlusion;
+    if (--engine.remainingRowPixels[in.y] == 0)
+    {
+        --engine.remainingRows;
+    }
 }
 
+struct RayTracer::Job
+{
+    const Camera traceCamera;
+    const SceneView shadowView;
+    const SceneView cameraView;
+    std::vector<math::Vec2f> sampleOffsets;
+    std::vector<RayInput> input;
+    RayContext context;
+
+    Job(RayTracer& engine, const Scene& scene, const Camera& camera, int firstRow, Image* canvas, bool keepHistory)
+    : traceCamera(engine.config.projection == PROJECTION_PERSPECTIVE ? camera : levelCamera(camera))
+    , shadowView(Scene::createShadowView(scene))
+    // Panoramas see all around, nothing can be culled
+    , cameraView(engine.config.projection == PROJECTION_PERSPECTIVE ? Scene::createCameraView(scene, camera) : SceneView(scene))
+    , context({canvas, firstRow, keepHistory, engine, cameraView, shadowView, traceCamera, sampleOffsets})
+    {}
+};
+
+RayTracer::RayTracer(const Config& config)
+: config(config)
+, breakX(-1)
+, breakY(-1)
+, abortTrace(false)
+, rowCount(0)
+, remainingRows(0)
+, remainingRowPixels(new std::atomic<int>[config.height])
+, primaryRays(0)
+, shadowRays(0)
+, occlusionRays(0)
+, frameCamera()
+, previousCamera()
+{
+    for (int ii = config.height - 1; ii >= 0; --ii)
+    {
+        remainingRowPixels[ii] = config.width;
+    }
+}
+
+RayTracer::~RayTracer() = default;
+
 const Image RayTracer::trace(const Scene& scene, const Camera& camera)
 {
     Image canvas(config.width, config.height, Image::FORMAT_ARGB);
@@ -57,12 +160,42 @@ const Image RayTracer::trace(const Scene& scene, const Camera& camera)
 
 void RayTracer::trace(const Scene& scene, const Camera& camera, Image* canvas)
 {
-    progress = 0.0f;
+    ASSERT(canvas->height == config.height);
+    trace(scene, camera, 0, canvas);
+}
+
+void RayTracer::trace(const Scene& scene, const Camera& camera, int firstRow, Image* canvas)
+{
+    Scheduler scheduler(config.threads);
+    startTrace(scene, camera, firstRow, canvas, &scheduler);
+
+    abortTrace = false;
+    while (!isFinished() && !abortTrace)
+    {
+        std::this_thread::yield();
+    }
+}
+
+void RayTracer::startTrace(const Scene& scene, const Camera& camera, int firstRow, Image* canvas, Scheduler* scheduler)
+{
+    ASSERT(canvas->width == config.width && firstRow >= 0 && firstRow + canvas->height <= config.height);
+    ASSERT(isFinished() || abortTrace); // The previous job may still be referenced by the scheduler otherwise
+
+    // Only whole frames are kept, the last one becomes the history this one reuses lighting from
+    const bool keepHistory = config.temporal && config.projection == PROJECTION_PERSPECTIVE && firstRow == 0 && canvas->height == config.height;
+    if (keepHistory)
+    {
+        history.swap(previousHistory);
+        history.resize(config.width * config.height);
+        previousCamera = frameCamera;
+        frameCamera = camera;
+    }
+    job.reset(new Job(*this, scene, camera, firstRow, canvas, keepHistory));
+
     const float sampleWidth = 1.0f / config.detail;
     const float sampleHeight = 1.0f / config.detail;
     const float halfSampleWidth = sampleWidth / 2.0f;
     const float halfSampleHeight = sampleHeight / 2.0f;
-    std::vector<math::Vec2f> sampleOffsets;
     for (int dx = config.detail - 1; dx >= 0; --dx)
     {
         for (int dy = config.detail - 1; dy >= 0; --dy)
@@ -71,51 +204,82 @@ void RayTracer::trace(const Scene& scene, const Camera& camera, Image* canvas)
                 sampleWidth * dx + halfSampleWidth,
                 sampleHeight * dy + halfSampleHeight,
             };
-            sampleOffsets.push_back(offset);
+            job->sampleOffsets.push_back(offset);
         }
     }
-    const math::Vec2f fbSize(static_cast<float>(canvas->width), static_cast<float>(canvas->height));
-
-    Scene shadowScene = Scene::createShadowScene(scene);
-    Scene optimized = Scene::cullGeometry(scene, camera);
-
-    RayContext context = {canvas, *this, optimized, shadowScene, camera, sampleOffsets};
 
-    std::vector<RayInput> input;
-    for (int x = canvas->width - 1; x >= 0; --x)
+    // One batch per row, the scheduler starts from the back so the bottom row comes first like in a TGA file
+    std::vector<RayInput>& input = job->input;
+    input.reserve(canvas->width * canvas->height);
+    for (int y = 0; y < canvas->height; ++y)
     {
-        for (int y = canvas->height - 1; y >= 0; --y)
+        remainingRowPixels[y] = canvas->width;
+        for (int x = canvas->width - 1; x >= 0; --x)
         {
             const int baseIdx = (x + y * canvas->width) * canvas->getPixelSize();
-            input.push_back({x, y, baseIdx, breakX == x && breakY == y});
+            input.push_back({x, y, baseIdx, breakX == x && breakY == y + firstRow});
         }
     }
 
-    Scheduler scheduler(config.threads);
-    scheduler.scheduleAsync<RayInput, RayContext>(input, context);
+    rowCount = canvas->height;
+    remainingRows = canvas->height;
+    primaryRays = shadowRays = occlusionRays = 0;
+    scheduler->scheduleAsync<RayInput, RayContext>(input, job->context, canvas->width);
+}
 
-    abortTrace = false;
-    while (!scheduler.isFinished() && !abortTrace)
+const math::Vec3f RayTracer::calcRayDirection(const Camera& camera, float x, float y) const
+{
+    math::Vec3f dir;
+    switch (config.projection)
     {
-        progress = 1.0f - scheduler.getTotalJobCount() / static_cast<float>(input.size());
-        std::this_thread::yield();
+        case PROJECTION_CUBEMAP:
+            {
+                // Every face spans 90 degrees, x runs across all of them
+                const float faceX = (x * 0.5f + 0.5f) * CUBE_FACE_COUNT;
+                const int faceIdx = math::clamp(static_cast<int>(faceX), 0, CUBE_FACE_COUNT - 1);
+                const float localX = (faceX - faceIdx) * 2.0f - 1.0f;
+                const CubeFace& face = CUBE_FACES[faceIdx];
+                dir = toWorld(camera, face.forward + face.right * localX + face.up * y);
+            }
+            break;
+        case PROJECTION_EQUIRECT:
+            {
+                const float longitude = x * math::PI;
+                const float latitude = y * math::PI * 0.5f;
+                const math::Vec3f local{std::cos(latitude) * std::cos(longitude), std::cos(latitude) * std::sin(longitude), std::sin(latitude)};
+                dir = toWorld(camera, local);
+            }
+            break;
+        case PROJECTION_PERSPECTIVE:
+        default:
+            dir = camera.direction;
+            dir += camera.right * (x * camera.halfViewAngles.x);
+            dir += camera.up * (y * camera.halfViewAngles.y);
+            break;
     }
-
-    progress = 1.0f;
+    math::normalize(&dir);
+    return dir;
 }
 
-const Color RayTracer::renderPixel(const Scene& scene, const Scene& shadowScene, const Camera& camera, float x, float y) const
+float RayTracer::calcSampleSpread(const Camera& camera) const
 {
-    Ray pixelRay;
+    // Angle between two neighbouring samples, small enough to use the tangent directly
+    switch (config.projection)
     {
-        math::Vec3f dir = camera.direction;
-        dir += camera.right * (x * camera.halfViewAngles.x);
-        dir += camera.up * (y * camera.halfViewAngles.y);
-        math::normalize(&dir);
-
-        pixelRay.origin = camera.origin;
-        pixelRay.dir = dir;
+        case PROJECTION_CUBEMAP: return 2.0f / (config.height * config.detail);
+        case PROJECTION_EQUIRECT: return math::PI2 / (config.width * config.detail);
+        case PROJECTION_PERSPECTIVE:
+        default: return 2.0f * camera.halfViewAngles.x / (config.width * config.detail);
     }
+}
+
+const Color RayTracer::renderPixel(const SceneView& view, const SceneView& shadowView, const Camera& camera, float x, float y, HistoryEntry* history, RayCount* rayCount) const
+{
+    const Scene& scene = *view.scene;
+    Ray pixelRay;
+    pixelRay.origin = camera.origin;
+    pixelRay.dir = calcRayDirection(camera, x, y);
+    ++rayCount->primary;
 
     collision3d::Hit infoSphere, infoPlane, infoTriangle, infoPolygon;
     infoSphere.t = camera.far;
@@ -123,13 +287,15 @@ const Color RayTracer::renderPixel(const Scene& scene, const Scene& shadowScene,
     infoPlane.t = infoSphere.t;
     int planeHitIdx = collision3d::raycastPlanes(pixelRay, infoSphere.t, scene.planes, &infoPlane);
     int triangleHitIdx = collision3d::raycastTriangles(pixelRay, infoPlane.t, scene.triangles, &infoTriangle);
-    int polygonHitIdx = collision3d::raycastConvexPolygons(pixelRay, infoPlane.t, scene.polygons, &infoPolygon);
+    int polygonInstanceIdx = -1;
+    int polygonHitIdx = collision3d::raycastModels(pixelRay, infoPlane.t, view, &infoPolygon, &polygonInstanceIdx);
 
     Color color;
     collision3d::Hit hitInfo;
     bool lighted = true;
     bool ambientOcclusion = true;
     bool selfShadow = true;
+    int surface = -1;
     if (triangleHitIdx > -1)
     {
         color = scene.triangles[triangleHitIdx].color;
@@ -147,7 +313,7 @@ const Color RayTracer::renderPixel(const Scene& scene, const Scene& shadowScene,
     }
     else if (polygonHitIdx > -1)
     {
-        const Scene::Material& mat = scene.polygons[polygonHitIdx].material;
+        const Scene::Material& mat = scene.materials[scene.polygons[polygonHitIdx].material];
         Scene::TexturePixel pixel;
         if (mat.flags[Scene::Material::FLAG_SKYSHADER])
         {
@@ -156,28 +322,90 @@ const Color RayTracer::renderPixel(const Scene& scene, const Scene& shadowScene,
         }
         else
         {
-            pixel = scene.getTexturePixel(mat, infoPolygon.pos);
+            // Textures stick to the model, so sample them in model space
+            const auto& instance = scene.instances[polygonInstanceIdx];
+            const float cosine = math::max(std::abs(math::dot(pixelRay.dir, infoPolygon.normal)), MIN_FOOTPRINT_COSINE);
+            const float footprint = infoPolygon.t * calcSampleSpread(camera) / cosine;
+            pixel = scene.getTexturePixel(mat, infoPolygon.pos - instance.origin, footprint);
             lighted = !pixel.fullbright;
             const bool shadowCaster = scene.polygons[polygonHitIdx].flags[Scene::ConvexPolygon::FLAG_SHADOWCAST];
             ambientOcclusion = shadowCaster;
             selfShadow = shadowCaster;
+            surface = polygonHitIdx;
         }
         color = pixel.color;
         hitInfo = infoPolygon;
     }
 
     float lightLevel = 0.0f;
-    if (lighted)
+    int age = 0;
+    const HistoryEntry* previous = history && lighted && surface > -1 ? reproject(hitInfo.pos, surface) : nullptr;
+    if (previous && previous->age < MAX_HISTORY_AGE)
+    {
+        lightLevel = previous->lightLevel;
+        age = previous->age + 1;
+    }
+    else if (lighted)
     {
         int occlusionRays = ambientOcclusion ? config.occlusionRayCount : 0;
-        lightLevel = shadowScene.lighting.calcLightLevel(hitInfo.pos, hitInfo.normal, shadowScene, config.softshadowRayCount, occlusionRays, config.occlusionRayStrength, selfShadow);
+        lightLevel = scene.lighting.calcLightLevel(hitInfo.pos, hitInfo.normal, shadowView, config.softshadowRayCount, occlusionRays, config.occlusionRayStrength, selfShadow, rayCount);
+        if (previous)
+        {
+            // Shadow and occlusion rays are random, blending in the expired level evens out the noise between refreshes
+            lightLevel = previous->lightLevel + (lightLevel - previous->lightLevel) * HISTORY_BLEND;
+        }
+        else if (surface > -1)
+        {
+            // Polygons start at different ages so they do not all refresh in the same frame
+            age = surface % MAX_HISTORY_AGE;
+        }
     }
     else
     {
         lightLevel = 1.0f;
     }
 
+    if (history)
+    {
+        *history = {hitInfo.pos, lighted ? surface : -1, lightLevel, age};
+    }
+
     color = color * lightLevel;
     Color::modifyGamma(&color, config.gamma);
     return color;
 }
+
+const RayTracer::HistoryEntry* RayTracer::reproject(const math::Vec3f& position, int surface) const
+{
+    if (previousHistory.empty())
+    {
+        return nullptr;
+    }
+
+    // Inverse of the primary ray setup in renderPixel
+    const Camera& camera = previousCamera;
+    const math::Vec3f offset = position - camera.origin;
+    const float depth = math::dot(offset, camera.direction);
+    if (depth <= camera.near)
+    {
+        return nullptr;
+    }
+    const float normX = math::dot(offset, camera.right) / (depth * camera.halfViewAngles.x);
+    const float normY = math::dot(offset, camera.up) / (depth * camera.halfViewAngles.y);
+    const int x = static_cast<int>(std::floor((normX * 0.5f + 0.5f) * config.width));
+    const int y = static_cast<int>(std::floor((0.5f - normY * 0.5f) * config.height));
+    if (x < 0 || x >= config.width || y < 0 || y >= config.height)
+    {
+        return nullptr;
+    }
+
+    // Lighting does not depend on the viewpoint, the same spot on the same surface is lit the same in both frames apart from ray noise.
+    // Anything else in front of it in the previous frame shows up as a different surface or position.
+    const HistoryEntry& entry = previousHistory[x + y * config.width];
+    const float tolerance = depth * calcSampleSpread(camera) * config.detail * REPROJECTION_TOLERANCE;
+    if (entry.surface != surface || math::distance2(entry.position, position) > tolerance * tolerance)
+    {
+        return nullptr;
+    }
+    return &entry;
+}
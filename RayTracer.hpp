@@ -1,49 +1,95 @@
 #pragma once
 #include "Image.hpp"
 #include "Color.hpp"
+#include "Camera.hpp"
+#include "Ray.hpp"
+#include <atomic>
+#include <memory>
+#include <vector>
 
 struct Scene;
-struct Camera;
+struct SceneView;
+class Scheduler;
 
 class RayTracer
 {
     friend struct RayContext;
 
 public:
+    enum Projection
+    {
+        PROJECTION_PERSPECTIVE,
+        PROJECTION_CUBEMAP, // Six square faces side by side: front, right, back, left, up, down
+        PROJECTION_EQUIRECT, // Longitude along the width and latitude along the height, all around the camera
+    };
+
     struct Config
     {
         int width;
         int height;
         int detail;
+        Projection projection; // Panoramas keep the horizon level and only follow the heading of the camera
 
         int softshadowRayCount;
         int occlusionRayCount;
         int occlusionRayStrength;
         float gamma;
+        bool temporal; // Reuse the lighting of the previous frame where the same surface is hit again
 
         int threads;
     };
 
-    RayTracer(const Config& config)
-    : config(config)
-    , breakX(-1)
-    , breakY(-1)
-    , progress(0.0f)
-    {}
+    RayTracer(const Config& config);
+    ~RayTracer();
 
     void setBreakPoint(int x, int y) { breakX = x; breakY = y; }
     void resetBreakPoint() { breakX = breakY = -1; }
 
-    float getProgress() const { return progress; }
+    float getProgress() const { return rowCount ? 1.0f - remainingRows / static_cast<float>(rowCount) : 0.0f; }
+    // Rows are traced from the bottom up, a finished row is safe to read while the trace continues
+    bool isRowFinished(int row) const { return remainingRowPixels[row] == 0; }
+    bool isFinished() const { return remainingRows == 0; }
+    const RayCount getRayCount() const { return {primaryRays, shadowRays, occlusionRays}; } // Rays cast by the current or last trace
     const Image trace(const Scene& scene, const Camera& camera);
     void trace(const Scene& scene, const Camera& camera, Image* target);
+    // Traces only the rows starting at firstRow that fit in the strip, which spans the full width
+    void trace(const Scene& scene, const Camera& camera, int firstRow, Image* strip);
+    // Queues the rows on a scheduler that can be shared with other tracers and returns right away.
+    // Scene, camera and strip have to stay alive until the trace is finished.
+    void startTrace(const Scene& scene, const Camera& camera, int firstRow, Image* strip, Scheduler* scheduler);
     void cancel() { abortTrace = true; }
 
 private:
-    const Color renderPixel(const Scene& scene, const Scene& shadowScene, const Camera& camera, float x, float y) const;
+    // Where a pixel hit the scene and how it was lit, kept for the next frame to reuse
+    struct HistoryEntry
+    {
+        math::Vec3f position;
+        int surface; // Polygon index, -1 when the lighting cannot be reused
+        float lightLevel;
+        int age; // Number of frames the light level has been reused since it was calculated
+    };
+
+    const Color renderPixel(const SceneView& view, const SceneView& shadowView, const Camera& camera, float x, float y, HistoryEntry* history, RayCount* rayCount) const;
+    const math::Vec3f calcRayDirection(const Camera& camera, float x, float y) const;
+    float calcSampleSpread(const Camera& camera) const;
+    // Finds the pixel of the previous frame that saw the same spot, nullptr when it was occluded or another surface
+    const HistoryEntry* reproject(const math::Vec3f& position, int surface) const;
+
+    struct Job;
 
     Config config;
     int breakX, breakY;
-    float progress;
     bool abortTrace;
+    int rowCount;
+    std::atomic<int> remainingRows;
+    std::unique_ptr<std::atomic<int>[]> remainingRowPixels;
+    std::atomic<std::uint64_t> primaryRays;
+    std::atomic<std::uint64_t> shadowRays;
+    std::atomic<std::uint64_t> occlusionRays;
+    std::unique_ptr<Job> job; // Kept until the next trace, queued tasks point into it
+
+    std::vector<HistoryEntry> history; // One entry per pixel of the frame being traced
+    std::vector<HistoryEntry> previousHistory;
+    Camera frameCamera;
+    Camera previousCamera;
 };
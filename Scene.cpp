@@ -14,72 +14,33 @@ namespace {
         return normalized;
     }
 
-    template<typename T>
-    inline bool isInFrontOfPlane(const Scene::Plane& plane, const T& geometry);
-
-    template<>
-    inline bool isInFrontOfPlane<math::Vec3f>(const Scene::Plane& plane, const math::Vec3f& point)
+    inline bool isInFrontOfPlane(const Scene::Plane& plane, const math::Vec3f& point)
     {
         auto diff = point - plane.origin;
         return math::dot(diff, plane.normal) >= 0;
     }
 
-    template<>
-    inline bool isInFrontOfPlane<Scene::Sphere>(const Scene::Plane& plane, const Scene::Sphere& sphere)
-    {
-        auto nearest = sphere.origin + plane.normal * sphere.radius;
-        return isInFrontOfPlane(plane, sphere.origin) || isInFrontOfPlane(plane, nearest);
-    }
-
-    template<>
-    inline bool isInFrontOfPlane<Scene::Triangle>(const Scene::Plane& plane, const Scene::Triangle& triangle)
+    inline bool isInFrontOfPlane(const Scene::Plane& plane, const Scene::ModelInstance& instance)
     {
-        return isInFrontOfPlane(plane, triangle.a) || isInFrontOfPlane(plane, triangle.b) || isInFrontOfPlane(plane, triangle.c);
+        // Only the box corner furthest along the plane normal needs to be tested
+        const auto& bounds = instance.bounds;
+        const math::Vec3f corner(
+            plane.normal.x >= 0 ? bounds.max.x : bounds.min.x,
+            plane.normal.y >= 0 ? bounds.max.y : bounds.min.y,
+            plane.normal.z >= 0 ? bounds.max.z : bounds.min.z
+        );
+        return isInFrontOfPlane(plane, corner);
     }
 
-    template<>
-    inline bool isInFrontOfPlane<Scene::ConvexPolygon>(const Scene::Plane& plane, const Scene::ConvexPolygon& poly)
+    inline math::BoundingBox calcPolygonBounds(const Scene::ConvexPolygon& poly)
     {
+        math::BoundingBox bounds = math::BoundingBox::createEmpty();
         for (int ii = util::lastIndex(poly.vertices); ii >= 0; --ii)
         {
-            if (isInFrontOfPlane(plane, poly.vertices[ii]))
-            {
-                return true;
-            }
-        }
-        return false;
-    }
-
-    template<>
-    inline bool isInFrontOfPlane<Scene::Plane>(const Scene::Plane& plane, const Scene::Plane& poly)
-    {
-        // TODO: test parallel planes
-        return true;
-    }
-
-    template<typename T>
-    const std::vector<T> testCulling(const std::vector<T>& geometryList, const Scene::Plane frustum[4])
-    {
-        std::vector<T> optimized;
-        optimized.reserve(geometryList.size());
-        for (int ii = util::lastIndex(geometryList); ii >= 0; --ii)
-        {
-            auto& geometry = geometryList[ii];
-            for (int jj = 0; jj < 4; ++jj)
-            {
-                if (!isInFrontOfPlane(frustum[jj], geometry))
-                {
-                    goto reject;
-                }
-            }
-            optimized.push_back(geometry);
-
-        reject:
-            ;
+            bounds.add(poly.vertices[ii]);
         }
-        return optimized;
+        return bounds;
     }
-
 }
 
 
@@ -118,8 +79,11 @@ void Scene::initDefault(Scene* scene)
         Material mat;
         mat.color = Color(1.0f, 0.5f, 0.5f);
         mat.texture = -1;
-        auto polygon = ConvexPolygon::create(polyVerts, normal, mat);
-        scene->polygons.push_back(polygon);
+        scene->materials.push_back(mat);
+        auto polygon = ConvexPolygon::create(polyVerts, normal, util::lastIndex(scene->materials));
+        const int model = scene->addModel({polygon}, calcPolygonBounds(polygon));
+        scene->addInstance(model, {0, 0, 0});
+        scene->buildInstanceBvh();
     }
 
     // Directional lights
@@ -128,29 +92,15 @@ void Scene::initDefault(Scene* scene)
     scene->lighting.ambient = 0.3f;
 }
 
-Scene Scene::createShadowScene(const Scene& scene)
+const SceneView Scene::createShadowView(const Scene& scene)
 {
-    Scene shadowScene;
-    shadowScene.lighting = scene.lighting;
-    shadowScene.cameras = scene.cameras;
-    shadowScene.spheres = scene.spheres;
-    shadowScene.planes = scene.planes;
-    shadowScene.triangles = scene.triangles;
-    shadowScene.polygons.reserve(scene.polygons.size());
-    for (int ii = util::lastIndex(scene.polygons); ii >= 0; --ii)
-    {
-        const auto& poly = scene.polygons[ii];
-        if (poly.flags[Scene::ConvexPolygon::FLAG_SHADOWCAST])
-        {
-            shadowScene.polygons.push_back(poly);
-        }
-    }
-    return shadowScene;
+    SceneView view(scene);
+    view.requiredPolygonFlag = ConvexPolygon::FLAG_SHADOWCAST;
+    return view;
 }
 
-Scene Scene::cullGeometry(const Scene& scene, const Camera& camera)
+const SceneView Scene::createCameraView(const Scene& scene, const Camera& camera)
 {
-    Scene optimized;
     const math::Vec3f up = math::normalized(camera.direction + camera.up * camera.halfViewAngles.y);
     const math::Vec3f down = math::normalized(camera.direction - camera.up * camera.halfViewAngles.y);
     const math::Vec3f left = math::normalized(camera.direction - camera.right * camera.halfViewAngles.x);
@@ -165,17 +115,84 @@ Scene Scene::cullGeometry(const Scene& scene, const Camera& camera)
         {camera.origin, leftNormal, Color()},
         {camera.origin, rightNormal, Color()},
     };
-    optimized.spheres = testCulling<Sphere>(scene.spheres, cullPlanes);
-    optimized.planes = testCulling<Plane>(scene.planes, cullPlanes);
-    optimized.triangles = testCulling<Triangle>(scene.triangles, cullPlanes);
-    optimized.polygons = testCulling<ConvexPolygon>(scene.polygons, cullPlanes);
-    optimized.textures = scene.textures;
-    return optimized;
+
+    // Polygons within a model are skipped by its own hierarchy, only whole instances need culling here
+    SceneView view(scene);
+    view.instances.resize(scene.instances.size());
+    for (int ii = util::lastIndex(scene.instances); ii >= 0; --ii)
+    {
+        bool inView = true;
+        for (int jj = 0; jj < 4 && inView; ++jj)
+        {
+            inView = isInFrontOfPlane(cullPlanes[jj], scene.instances[ii]);
+        }
+        view.instances[ii] = inView;
+    }
+    return view;
+}
+
+int Scene::addModel(const std::vector<ConvexPolygon>& modelPolygons, const math::BoundingBox& bounds)
+{
+    Model model;
+    model.firstPolygon = static_cast<int>(polygons.size());
+    model.polygonCount = static_cast<int>(modelPolygons.size());
+    model.levelModel = -1;
+
+    std::vector<math::BoundingBox> polygonBounds(modelPolygons.size());
+    for (int ii = util::lastIndex(modelPolygons); ii >= 0; --ii)
+    {
+        polygonBounds[ii] = calcPolygonBounds(modelPolygons[ii]);
+    }
+    model.bvh = Bvh::create(polygonBounds);
+
+    model.bounds = bounds;
+    if (!model.bvh.isEmpty())
+    {
+        model.bounds.add(model.bvh.nodes[0].bounds);
+    }
+
+    polygons.insert(polygons.end(), modelPolygons.begin(), modelPolygons.end());
+    models.push_back(model);
+    return util::lastIndex(models);
+}
+
+int Scene::addInstance(int model, const math::Vec3f& origin)
+{
+    ASSERT(0 <= model && model < static_cast<int>(models.size()));
+    ModelInstance instance;
+    instance.model = model;
+    instance.origin = origin;
+    instance.bounds = models[model].bounds.translated(origin);
+    instance.visible = true;
+    instances.push_back(instance);
+    return util::lastIndex(instances);
+}
+
+void Scene::buildInstanceBvh()
+{
+    std::vector<math::BoundingBox> instanceBounds(instances.size());
+    for (int ii = util::lastIndex(instances); ii >= 0; --ii)
+    {
+        instanceBounds[ii] = instances[ii].bounds;
+    }
+    instanceBvh = Bvh::create(instanceBounds);
+}
+
+void Scene::moveInstance(int instance, const math::Vec3f& origin)
+{
+    ASSERT(!instanceBvh.isEmpty());
+    ModelInstance& inst = instances[instance];
+    inst.origin = origin;
+    inst.bounds = models[inst.model].bounds.translated(origin);
+
+    // Model hierarchies live in model space, so only the instance level needs updating
+    instanceBvh.refit(instance, [this](int idx) { return instances[idx].bounds; });
 }
 
-const Scene::ConvexPolygon Scene::ConvexPolygon::create(const std::vector<math::Vec3f>& vertices, const math::Vec3f& normal, const Material& material)
+const Scene::ConvexPolygon Scene::ConvexPolygon::create(const std::vector<math::Vec3f>& vertices, const math::Vec3f& normal, int material)
 {
     ASSERT(vertices.size() > 2);
+    ASSERT(0 <= material);
 
     ConvexPolygon poly;
     poly.material = material;
@@ -206,20 +223,18 @@ const Scene::ConvexPolygon Scene::ConvexPolygon::create(const std::vector<math::
     return poly;
 }
 
-Scene::TexturePixel Scene::getTexturePixel(const Scene::Material& mat, const math::Vec3f& pos) const
+Scene::TexturePixel Scene::getTexturePixel(const Scene::Material& mat, const math::Vec3f& pos, float footprint) const
 {
     if (mat.texture > -1)
     {
         auto uv = mat.positionToUV(pos);
-        auto& data = textures[mat.texture];
-        const Texture& tex = data.texture;
-        const auto& fullbright = data.fullbright;
-        const int x = normalize(uv.x, tex.getWidth());
-        const int y = normalize(uv.y, tex.getHeight());
-        Color c = tex.sample(x, y) + mat.color;
+        const auto& data = textures[mat.texture];
+        const float texelsPerUnit = math::max(math::length(mat.u), math::length(mat.v));
+        const int level = data.texture.selectLevel(footprint * texelsPerUnit);
+        const int index = data.texture.sample(uv.x, uv.y, level);
+        Color c = palettes[data.palette].colors[index] + mat.color;
         Color::normalize(&c);
-        const int idx = x + y * tex.getWidth();
-        return {c, fullbright[idx]};
+        return {c, Palette::isFullbright(index)};
     }
     else
     {
@@ -243,11 +258,13 @@ Scene::TexturePixel Scene::getSkyPixel(const Material& mat, const Ray& ray, cons
     uv.x = static_cast<int>((temp + 6*(SKY_SIZE/2-1)*skyDir.x) * 0x10000) >> SKY_SPAN_SHIFT;
     uv.y = static_cast<int>((temp + 6*(SKY_SIZE/2-1)*skyDir.y) * 0x10000) >> SKY_SPAN_SHIFT;
 
-    const Texture& tex = textures[mat.texture].texture;
+    const auto& data = textures[mat.texture];
+    const IndexedTexture& tex = data.texture;
+    const Palette& palette = palettes[data.palette];
     const int x = normalize(uv.x, tex.getWidth() >> 1);
     const int y = normalize(uv.y, tex.getHeight());
-    Color frontPlane = tex.sample(x, y);
-    Color backPlane = tex.sample(x + (tex.getWidth() >> 1), y);
+    Color frontPlane = palette.colors[tex.getIndex(x, y)];
+    Color backPlane = palette.colors[tex.getIndex(x + (tex.getWidth() >> 1), y)];
     if (!Color::isBlack(frontPlane))
     {
         backPlane = frontPlane;
@@ -5,16 +5,22 @@
 #include "Texture.hpp"
 #include "Lighting.hpp"
 #include "Camera.hpp"
+#include "BoundingBox.hpp"
+#include "Bvh.hpp"
 #include <vector>
+#include <bitset>
+#include <memory>
+#include <cstdint>
 
 class FrameBuffer;
 struct Ray;
+struct SceneView;
 
 struct Scene
 {
     struct Material
     {
-        Material() : texture(-1), color(0.0f, 0.0f, 0.0f), flags(NUM_FLAGS) {}
+        Material() : texture(-1), color(0.0f, 0.0f, 0.0f) {}
 
         int texture;
         math::Vec3f u;
@@ -28,7 +34,7 @@ struct Scene
             FLAG_SKYSHADER,
             NUM_FLAGS,
         };
-        std::vector<bool> flags;
+        std::bitset<NUM_FLAGS> flags;
 
         math::Vec2f positionToUV(const math::Vec3f& pos) const;
     };
@@ -58,7 +64,7 @@ struct Scene
 
     struct ConvexPolygon
     {
-        static const ConvexPolygon create(const std::vector<math::Vec3f>& vertices, const math::Vec3f& normal, const Material& material);
+        static const ConvexPolygon create(const std::vector<math::Vec3f>& vertices, const math::Vec3f& normal, int material);
 
         std::vector<math::Vec3f> vertices;
 
@@ -70,7 +76,7 @@ struct Scene
         std::vector<math::Vec3f> edgeNormals;
         std::vector<Plane> edgePlanes;
 
-        Material material;
+        int material; // Index into Scene::materials
 
         // Flags
         enum Flag
@@ -79,10 +85,30 @@ struct Scene
             FLAG_SHADOWCAST,
             NUM_FLAGS,
         };
-        std::vector<bool> flags;
+        std::bitset<NUM_FLAGS> flags;
 
     private:
-        ConvexPolygon() : flags(NUM_FLAGS) {}
+        friend struct SceneCache;
+        ConvexPolygon() : material(0) {}
+    };
+
+    // A group of polygons with its own acceleration structure, like the world or a brush entity
+    struct Model
+    {
+        int firstPolygon;
+        int polygonCount;
+        int levelModel; // Model number in the level file (the N of a *N model key), -1 for models built in code
+        math::BoundingBox bounds;
+        Bvh bvh; // Primitive indices are relative to firstPolygon
+    };
+
+    // Placement of a model in the world, models can be instanced more than once
+    struct ModelInstance
+    {
+        int model;
+        math::Vec3f origin;
+        math::BoundingBox bounds; // World space bounds
+        bool visible;
     };
 
     std::vector<Camera> cameras;
@@ -90,13 +116,23 @@ struct Scene
     std::vector<Plane> planes;
     std::vector<Triangle> triangles;
     std::vector<ConvexPolygon> polygons;
+    std::vector<Material> materials;
+    std::vector<Model> models;
+    std::vector<ModelInstance> instances;
+    Bvh instanceBvh;
     Lighting lighting;
 
+    int addModel(const std::vector<ConvexPolygon>& modelPolygons, const math::BoundingBox& bounds);
+    int addInstance(int model, const math::Vec3f& origin);
+    void buildInstanceBvh();
+    void moveInstance(int instance, const math::Vec3f& origin);
+
     struct TextureData
     {
-        Texture texture;
-        std::vector<bool> fullbright;
+        IndexedTexture texture;
+        int palette; // Index into Scene::palettes
     };
+    std::vector<Palette> palettes;
     std::vector<TextureData> textures;
 
     struct TexturePixel
@@ -104,12 +140,29 @@ struct Scene
         Color color;
         bool fullbright;
     };
-    TexturePixel getTexturePixel(const Material& mat, const math::Vec3f& pos) const;
+    // footprint is the width of the surface area covered by the sample, used to pick a mip level
+    TexturePixel getTexturePixel(const Material& mat, const math::Vec3f& pos, float footprint) const;
     TexturePixel getSkyPixel(const Material& mat, const Ray& ray, const Camera& camera, const math::Vec2i& screen) const;
 
     static void initDefault(Scene* scene);
-    static Scene createShadowScene(const Scene& scene);
-    static Scene cullGeometry(const Scene& scene, const Camera& camera);
+    static const SceneView createShadowView(const Scene& scene);
+    static const SceneView createCameraView(const Scene& scene, const Camera& camera);
+};
+
+// Scenes are immutable while being traced, so traces and threads share them instead of copying
+typedef std::shared_ptr<const Scene> ScenePtr;
+
+// Selection of a scene used for a specific kind of ray, without copying any of its geometry
+struct SceneView
+{
+    explicit SceneView(const Scene& scene) : scene(&scene), requiredPolygonFlag(-1) {}
+
+    const Scene* scene;
+    std::vector<bool> instances;    // Instances in view, an empty list includes all instances
+    int requiredPolygonFlag;        // Only polygons with this flag are in view, -1 includes all polygons
+
+    bool hasInstance(int instance) const { return instances.empty() || instances[instance]; }
+    bool hasPolygon(const Scene::ConvexPolygon& poly) const { return requiredPolygonFlag < 0 || poly.flags[requiredPolygonFlag]; }
 };
 
 inline math::Vec2f Scene::Material::positionToUV(const math::Vec3f& pos) const
@@ -0,0 +1,491 @@
+#include "SceneCache.hpp"
+#include "Scene.hpp"
+#include "File.hpp"
+#include "BinaryWriter.hpp"
+#include "ArrayView.hpp"
+#include "Util.hpp"
+#include "Math.hpp"
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+namespace {
+    static const char MAGIC[4] = {'Q', 'T', 'S', 'C'};
+    static const std::uint32_t VERSION = 6; // Bump whenever the loader output or the layout below changes
+    static const int SECTION_ALIGNMENT = 16;
+
+    enum Sections
+    {
+        SECTION_SCENE,
+        SECTION_CAMERAS,
+        SECTION_SPHERES,
+        SECTION_PLANES,
+        SECTION_TRIANGLES,
+        SECTION_POLYGONS,
+        SECTION_POLYGON_VERTICES,
+        SECTION_POLYGON_EDGE_NORMALS,
+        SECTION_POLYGON_EDGE_PLANES,
+        SECTION_MATERIALS,
+        SECTION_MODELS,
+        SECTION_INSTANCES,
+        SECTION_BVH_NODES,
+        SECTION_BVH_PARENTS,
+        SECTION_BVH_INDICES,
+        SECTION_BVH_LEAVES,
+        SECTION_POINT_LIGHTS,
+        SECTION_DIRECTIONAL_LIGHTS,
+        SECTION_SPOT_LIGHTS,
+        SECTION_PALETTES,
+        SECTION_TEXTURES,
+        SECTION_TEXTURE_INDICES,
+        NUM_SECTIONS,
+    };
+
+    struct Section
+    {
+        std::uint64_t offset;
+        std::uint32_t count;
+        std::uint32_t elementSize;
+    };
+
+    struct Header
+    {
+        char magic[4];
+        std::uint32_t version;
+        std::uint64_t key;
+        Section sections[NUM_SECTIONS];
+    };
+
+    // Ranges into the shared BVH arrays, nodes and parents share one range, indices and leaves the other
+    struct BvhRecord
+    {
+        std::int32_t firstNode;
+        std::int32_t nodeCount;
+        std::int32_t firstIndex;
+        std::int32_t indexCount;
+    };
+
+    struct SceneRecord
+    {
+        float ambient;
+        BvhRecord instanceBvh;
+    };
+
+    struct PolygonRecord
+    {
+        Scene::ConvexPolygon::Plane plane;
+        std::int32_t firstVertex;
+        std::int32_t vertexCount;
+        std::uint32_t material;
+        std::uint32_t flags;
+    };
+
+    struct ModelRecord
+    {
+        std::int32_t firstPolygon;
+        std::int32_t polygonCount;
+        std::int32_t levelModel;
+        math::BoundingBox bounds;
+        BvhRecord bvh;
+    };
+
+    struct TextureRecord
+    {
+        std::int32_t width;
+        std::int32_t height;
+        std::int32_t levelCount;
+        std::int32_t palette;
+        std::int32_t firstIndex;    // Indices of all levels follow each other
+    };
+
+    // Traversal and refitting follow the links of a hierarchy unchecked, so a loaded one has to be consistent first.
+    // The builder appends children after their parent, which also rules out cycles.
+    bool isValidHierarchy(const Bvh& bvh, int primitiveCount)
+    {
+        const int nodeCount = static_cast<int>(bvh.nodes.size());
+        const int indexCount = static_cast<int>(bvh.indices.size());
+        if (indexCount != primitiveCount) { return false; }
+        for (int ii = nodeCount - 1; ii >= 0; --ii)
+        {
+            const Bvh::Node& node = bvh.nodes[ii];
+            const bool validNode = node.isLeaf()
+                ? node.first >= 0 && node.first <= indexCount - node.count
+                : node.count == 0 && node.first > ii && node.first < nodeCount - 1;
+            const int parent = bvh.parents[ii];
+            if (!validNode || parent < -1 || parent >= ii) { return false; }
+        }
+
+        // Traversal stacks only hold Bvh::MAX_DEPTH levels, children that hang below several parents count at the deepest
+        std::vector<int> depths(nodeCount, 0);
+        for (int ii = 0; ii < nodeCount; ++ii)
+        {
+            const Bvh::Node& node = bvh.nodes[ii];
+            if (node.isLeaf()) { continue; }
+            if (depths[ii] + 1 > Bvh::MAX_DEPTH) { return false; }
+            depths[node.first] = math::max(depths[node.first], depths[ii] + 1);
+            depths[node.first + 1] = math::max(depths[node.first + 1], depths[ii] + 1);
+        }
+        for (int ii = indexCount - 1; ii >= 0; --ii)
+        {
+            if (bvh.indices[ii] < 0 || bvh.indices[ii] >= primitiveCount) { return false; }
+            if (bvh.leaves[ii] < 0 || bvh.leaves[ii] >= nodeCount) { return false; }
+        }
+        return true;
+    }
+
+    inline std::uint64_t fnv1a(std::uint64_t hash, const void* data, std::size_t size)
+    {
+        const std::uint8_t* bytes = reinterpret_cast<const std::uint8_t*>(data);
+        for (std::size_t ii = 0; ii < size; ++ii)
+        {
+            hash ^= bytes[ii];
+            hash *= 0x100000001b3ULL;
+        }
+        return hash;
+    }
+
+    struct Writer
+    {
+        util::BinaryWriter sections[NUM_SECTIONS];
+        std::uint32_t counts[NUM_SECTIONS];
+        std::uint32_t elementSizes[NUM_SECTIONS];
+
+        Writer()
+        {
+            std::memset(counts, 0, sizeof(counts));
+            std::memset(elementSizes, 0, sizeof(elementSizes));
+        }
+
+        template<typename T>
+        void add(int section, const T* items, std::size_t count)
+        {
+            elementSizes[section] = sizeof(T);
+            counts[section] += static_cast<std::uint32_t>(count);
+            if (count) { sections[section].write(reinterpret_cast<const std::uint8_t*>(items), count * sizeof(T)); }
+        }
+
+        template<typename T>
+        void add(int section, const std::vector<T>& items) { add(section, items.data(), items.size()); }
+
+        template<typename T>
+        void add(int section, const T& item) { add(section, &item, 1); }
+
+        const BvhRecord addBvh(const Bvh& bvh)
+        {
+            BvhRecord record;
+            record.firstNode = counts[SECTION_BVH_NODES];
+            record.nodeCount = static_cast<std::int32_t>(bvh.nodes.size());
+            record.firstIndex = counts[SECTION_BVH_INDICES];
+            record.indexCount = static_cast<std::int32_t>(bvh.indices.size());
+            add(SECTION_BVH_NODES, bvh.nodes);
+            add(SECTION_BVH_PARENTS, bvh.parents);
+            add(SECTION_BVH_INDICES, bvh.indices);
+            add(SECTION_BVH_LEAVES, bvh.leaves);
+            return record;
+        }
+
+        const std::vector<std::uint8_t> finish(std::uint64_t key) const
+        {
+            Header header;
+            std::memset(&header, 0, sizeof(header));
+            std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+            header.version = VERSION;
+            header.key = key;
+
+            std::uint64_t offset = sizeof(Header);
+            for (int ii = 0; ii < NUM_SECTIONS; ++ii)
+            {
+                offset = (offset + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+                header.sections[ii] = {offset, counts[ii], elementSizes[ii]};
+                offset += sections[ii].stream.size();
+            }
+
+            std::vector<std::uint8_t> file(offset, 0);
+            std::memcpy(file.data(), &header, sizeof(header));
+            for (int ii = 0; ii < NUM_SECTIONS; ++ii)
+            {
+                const auto& stream = sections[ii].stream;
+                if (!stream.empty()) { std::memcpy(file.data() + header.sections[ii].offset, stream.data(), stream.size()); }
+            }
+            return file;
+        }
+    };
+
+    struct Reader
+    {
+        const std::uint8_t* data;
+        const Header* header;
+
+        template<typename T>
+        const util::ArrayView<T> get(int section) const
+        {
+            const Section& entry = header->sections[section];
+            return {util::castFromMemory<T>(data, static_cast<int>(entry.offset)), static_cast<int>(entry.count)};
+        }
+
+        template<typename T>
+        bool isValid(int section, std::size_t size) const
+        {
+            const Section& entry = header->sections[section];
+            if (entry.count == 0) { return true; }
+            return entry.elementSize == sizeof(T)
+                && entry.offset % SECTION_ALIGNMENT == 0
+                && entry.offset + std::uint64_t(entry.count) * sizeof(T) <= size;
+        }
+
+        template<typename T>
+        void copy(int section, int first, int count, std::vector<T>* items) const
+        {
+            auto view = get<T>(section);
+            items->assign(view.array + first, view.array + first + count);
+        }
+
+        bool isInside(int section, std::int64_t first, std::int64_t count) const
+        {
+            return first >= 0 && count >= 0 && first + count <= header->sections[section].count;
+        }
+
+        bool isValidBvh(const BvhRecord& bvh) const
+        {
+            return isInside(SECTION_BVH_NODES, bvh.firstNode, bvh.nodeCount)
+                && isInside(SECTION_BVH_INDICES, bvh.firstIndex, bvh.indexCount);
+        }
+
+        void readBvh(const BvhRecord& record, Bvh* bvh) const
+        {
+            copy(SECTION_BVH_NODES, record.firstNode, record.nodeCount, &bvh->nodes);
+            copy(SECTION_BVH_PARENTS, record.firstNode, record.nodeCount, &bvh->parents);
+            copy(SECTION_BVH_INDICES, record.firstIndex, record.indexCount, &bvh->indices);
+            copy(SECTION_BVH_LEAVES, record.firstIndex, record.indexCount, &bvh->leaves);
+        }
+    };
+}
+
+std::uint64_t SceneCache::calcKey(const void* bspData, std::size_t bspSize, const BspLoader::Options& options)
+{
+    std::uint64_t hash = 0xcbf29ce484222325ULL;
+    hash = fnv1a(hash, &VERSION, sizeof(VERSION));
+    hash = fnv1a(hash, &options.mergeFaces, sizeof(options.mergeFaces));
+    if (options.palette)
+    {
+        hash = fnv1a(hash, options.palette, Palette::SIZE * 3);
+    }
+    return fnv1a(hash, bspData, bspSize);
+}
+
+bool SceneCache::save(const char* filename, std::uint64_t key, const Scene& scene)
+{
+    Writer writer;
+
+    writer.add(SECTION_CAMERAS, scene.cameras);
+    writer.add(SECTION_SPHERES, scene.spheres);
+    writer.add(SECTION_PLANES, scene.planes);
+    writer.add(SECTION_TRIANGLES, scene.triangles);
+    writer.add(SECTION_MATERIALS, scene.materials);
+    writer.add(SECTION_INSTANCES, scene.instances);
+    writer.add(SECTION_POINT_LIGHTS, scene.lighting.points);
+    writer.add(SECTION_DIRECTIONAL_LIGHTS, scene.lighting.directional);
+    writer.add(SECTION_SPOT_LIGHTS, scene.lighting.spots);
+
+    for (const auto& poly : scene.polygons)
+    {
+        PolygonRecord record;
+        record.plane = poly.plane;
+        record.firstVertex = writer.counts[SECTION_POLYGON_VERTICES];
+        record.vertexCount = static_cast<std::int32_t>(poly.vertices.size());
+        record.material = poly.material;
+        record.flags = static_cast<std::uint32_t>(poly.flags.to_ulong());
+        writer.add(SECTION_POLYGONS, record);
+        writer.add(SECTION_POLYGON_VERTICES, poly.vertices);
+        writer.add(SECTION_POLYGON_EDGE_NORMALS, poly.edgeNormals);
+        writer.add(SECTION_POLYGON_EDGE_PLANES, poly.edgePlanes);
+    }
+
+    for (const auto& model : scene.models)
+    {
+        ModelRecord record;
+        record.firstPolygon = model.firstPolygon;
+        record.polygonCount = model.polygonCount;
+        record.levelModel = model.levelModel;
+        record.bounds = model.bounds;
+        record.bvh = writer.addBvh(model.bvh);
+        writer.add(SECTION_MODELS, record);
+    }
+
+    writer.add(SECTION_PALETTES, scene.palettes);
+    for (const auto& data : scene.textures)
+    {
+        TextureRecord record;
+        record.width = data.texture.getWidth();
+        record.height = data.texture.getHeight();
+        record.levelCount = data.texture.getLevelCount();
+        record.palette = data.palette;
+        record.firstIndex = writer.counts[SECTION_TEXTURE_INDICES];
+        writer.add(SECTION_TEXTURES, record);
+        writer.add(SECTION_TEXTURE_INDICES, data.texture.getIndices());
+    }
+
+    SceneRecord record;
+    record.ambient = scene.lighting.ambient;
+    record.instanceBvh = writer.addBvh(scene.instanceBvh);
+    writer.add(SECTION_SCENE, record);
+
+    // Write next to the target and swap it in, so concurrent renders never see a partial cache
+    const auto contents = writer.finish(key);
+    const std::string tempFilename = std::string(filename) + ".tmp";
+    {
+        File file = File::openW(tempFilename.c_str());
+        if (!file.isValid() || file.write(contents.data(), contents.size()) != 1)
+        {
+            std::remove(tempFilename.c_str());
+            return false;
+        }
+    }
+    if (std::rename(tempFilename.c_str(), filename) != 0)
+    {
+        std::remove(filename);
+        if (std::rename(tempFilename.c_str(), filename) != 0)
+        {
+            std::remove(tempFilename.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SceneCache::load(const char* filename, std::uint64_t key, Scene* scene)
+{
+    ASSERT(scene != nullptr);
+
+    FileMapping mapping = FileMapping::open(filename);
+    if (!mapping.isValid() || mapping.size() < sizeof(Header)) { return false; }
+
+    Reader reader;
+    reader.data = reinterpret_cast<const std::uint8_t*>(mapping.getData());
+    reader.header = util::castFromMemory<Header>(reader.data);
+    const Header& header = *reader.header;
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION || header.key != key)
+    {
+        return false;
+    }
+
+    const std::size_t size = mapping.size();
+    const bool validSections = reader.isValid<SceneRecord>(SECTION_SCENE, size)
+        && reader.isValid<Camera>(SECTION_CAMERAS, size)
+        && reader.isValid<Scene::Sphere>(SECTION_SPHERES, size)
+        && reader.isValid<Scene::Plane>(SECTION_PLANES, size)
+        && reader.isValid<Scene::Triangle>(SECTION_TRIANGLES, size)
+        && reader.isValid<PolygonRecord>(SECTION_POLYGONS, size)
+        && reader.isValid<math::Vec3f>(SECTION_POLYGON_VERTICES, size)
+        && reader.isValid<math::Vec3f>(SECTION_POLYGON_EDGE_NORMALS, size)
+        && reader.isValid<Scene::ConvexPolygon::Plane>(SECTION_POLYGON_EDGE_PLANES, size)
+        && reader.isValid<Scene::Material>(SECTION_MATERIALS, size)
+        && reader.isValid<ModelRecord>(SECTION_MODELS, size)
+        && reader.isValid<Scene::ModelInstance>(SECTION_INSTANCES, size)
+        && reader.isValid<Bvh::Node>(SECTION_BVH_NODES, size)
+        && reader.isValid<int>(SECTION_BVH_PARENTS, size)
+        && reader.isValid<int>(SECTION_BVH_INDICES, size)
+        && reader.isValid<int>(SECTION_BVH_LEAVES, size)
+        && reader.isValid<Lighting::Point>(SECTION_POINT_LIGHTS, size)
+        && reader.isValid<Lighting::Directional>(SECTION_DIRECTIONAL_LIGHTS, size)
+        && reader.isValid<Lighting::Spot>(SECTION_SPOT_LIGHTS, size)
+        && reader.isValid<Palette>(SECTION_PALETTES, size)
+        && reader.isValid<TextureRecord>(SECTION_TEXTURES, size)
+        && reader.isValid<std::uint8_t>(SECTION_TEXTURE_INDICES, size)
+        && header.sections[SECTION_SCENE].count == 1
+        && header.sections[SECTION_POLYGON_EDGE_NORMALS].count == header.sections[SECTION_POLYGON_VERTICES].count
+        && header.sections[SECTION_POLYGON_EDGE_PLANES].count == header.sections[SECTION_POLYGON_VERTICES].count
+        && header.sections[SECTION_BVH_PARENTS].count == header.sections[SECTION_BVH_NODES].count
+        && header.sections[SECTION_BVH_LEAVES].count == header.sections[SECTION_BVH_INDICES].count;
+    if (!validSections) { return false; }
+
+    const SceneRecord& record = reader.get<SceneRecord>(SECTION_SCENE)[0];
+    if (!reader.isValidBvh(record.instanceBvh)) { return false; }
+
+    Scene result;
+    reader.copy(SECTION_CAMERAS, 0, header.sections[SECTION_CAMERAS].count, &result.cameras);
+    reader.copy(SECTION_SPHERES, 0, header.sections[SECTION_SPHERES].count, &result.spheres);
+    reader.copy(SECTION_PLANES, 0, header.sections[SECTION_PLANES].count, &result.planes);
+    reader.copy(SECTION_TRIANGLES, 0, header.sections[SECTION_TRIANGLES].count, &result.triangles);
+    reader.copy(SECTION_MATERIALS, 0, header.sections[SECTION_MATERIALS].count, &result.materials);
+    reader.copy(SECTION_INSTANCES, 0, header.sections[SECTION_INSTANCES].count, &result.instances);
+    reader.copy(SECTION_POINT_LIGHTS, 0, header.sections[SECTION_POINT_LIGHTS].count, &result.lighting.points);
+    reader.copy(SECTION_DIRECTIONAL_LIGHTS, 0, header.sections[SECTION_DIRECTIONAL_LIGHTS].count, &result.lighting.directional);
+    reader.copy(SECTION_SPOT_LIGHTS, 0, header.sections[SECTION_SPOT_LIGHTS].count, &result.lighting.spots);
+    result.lighting.ambient = record.ambient;
+    reader.readBvh(record.instanceBvh, &result.instanceBvh);
+
+    auto polygons = reader.get<PolygonRecord>(SECTION_POLYGONS);
+    result.polygons.reserve(polygons.size);
+    for (int ii = 0; ii < polygons.size; ++ii)
+    {
+        const PolygonRecord& polyRecord = polygons[ii];
+        if (!reader.isInside(SECTION_POLYGON_VERTICES, polyRecord.firstVertex, polyRecord.vertexCount)) { return false; }
+        Scene::ConvexPolygon poly;
+        poly.plane = polyRecord.plane;
+        if (polyRecord.material >= result.materials.size()) { return false; }
+        poly.material = static_cast<int>(polyRecord.material);
+        poly.flags = std::bitset<Scene::ConvexPolygon::NUM_FLAGS>(polyRecord.flags);
+        reader.copy(SECTION_POLYGON_VERTICES, polyRecord.firstVertex, polyRecord.vertexCount, &poly.vertices);
+        reader.copy(SECTION_POLYGON_EDGE_NORMALS, polyRecord.firstVertex, polyRecord.vertexCount, &poly.edgeNormals);
+        reader.copy(SECTION_POLYGON_EDGE_PLANES, polyRecord.firstVertex, polyRecord.vertexCount, &poly.edgePlanes);
+        result.polygons.push_back(poly);
+    }
+
+    auto models = reader.get<ModelRecord>(SECTION_MODELS);
+    result.models.resize(models.size);
+    for (int ii = 0; ii < models.size; ++ii)
+    {
+        const ModelRecord& modelRecord = models[ii];
+        if (!reader.isValidBvh(modelRecord.bvh) || !reader.isInside(SECTION_POLYGONS, modelRecord.firstPolygon, modelRecord.polygonCount))
+        {
+            return false;
+        }
+        Scene::Model& model = result.models[ii];
+        model.firstPolygon = modelRecord.firstPolygon;
+        model.polygonCount = modelRecord.polygonCount;
+        model.levelModel = modelRecord.levelModel;
+        model.bounds = modelRecord.bounds;
+        reader.readBvh(modelRecord.bvh, &model.bvh);
+        if (!isValidHierarchy(model.bvh, model.polygonCount)) { return false; }
+    }
+
+    for (const auto& instance : result.instances)
+    {
+        if (instance.model < 0 || instance.model >= models.size) { return false; }
+    }
+    if (!isValidHierarchy(result.instanceBvh, static_cast<int>(result.instances.size()))) { return false; }
+
+    reader.copy(SECTION_PALETTES, 0, header.sections[SECTION_PALETTES].count, &result.palettes);
+    auto textures = reader.get<TextureRecord>(SECTION_TEXTURES);
+    auto indices = reader.get<std::uint8_t>(SECTION_TEXTURE_INDICES);
+    result.textures.reserve(textures.size);
+    for (int ii = 0; ii < textures.size; ++ii)
+    {
+        const TextureRecord& textureRecord = textures[ii];
+        if (textureRecord.width <= 0 || textureRecord.height <= 0 || textureRecord.levelCount <= 0
+            || textureRecord.levelCount > IndexedTexture::calcLevelCount(textureRecord.width, textureRecord.height)
+            || !reader.isInside(SECTION_PALETTES, textureRecord.palette, 1))
+        {
+            return false;
+        }
+        const void* mips[IndexedTexture::MAX_LEVELS];
+        std::int64_t offset = textureRecord.firstIndex;
+        for (int level = 0; level < textureRecord.levelCount; ++level)
+        {
+            mips[level] = indices.array + offset;
+            offset += std::int64_t(textureRecord.width >> level) * (textureRecord.height >> level);
+        }
+        if (!reader.isInside(SECTION_TEXTURE_INDICES, textureRecord.firstIndex, offset - textureRecord.firstIndex)) { return false; }
+        auto texture = IndexedTexture::createFromMips(textureRecord.width, textureRecord.height, mips, textureRecord.levelCount);
+        result.textures.push_back({texture, textureRecord.palette});
+    }
+
+    for (const auto& material : result.materials)
+    {
+        if (material.texture < -1 || material.texture >= static_cast<int>(result.textures.size())) { return false; }
+    }
+
+    *scene = std::move(result);
+    return true;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "BspLoader.hpp"
+#include <cstdint>
+#include <cstddef>
+
+struct Scene;
+
+// Binary snapshot of a fully loaded scene, including its acceleration structures.
+// Every array is stored as an offset/count pair, so the file can be mapped and read in place.
+struct SceneCache
+{
+    static std::uint64_t calcKey(const void* bspData, std::size_t bspSize, const BspLoader::Options& options);
+
+    // Fails when the file is missing, damaged, written by another version or built from different input
+    static bool load(const char* filename, std::uint64_t key, Scene* scene);
+    static bool save(const char* filename, std::uint64_t key, const Scene& scene);
+};
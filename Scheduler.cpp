@@ -23,6 +23,8 @@ void Scheduler::Worker::run()
         }
 
         task = nullptr;
+        // The monitor may have looked before the task was cleared, let it see this worker is idle now
+        if (owner) { owner->notifyMonitor(); }
     }
 }
 
@@ -40,6 +42,8 @@ void Scheduler::Worker::stop()
     ScopedLock lock(stateLock);
     ASSERT(running);
     running = false;
+    // An idle worker would otherwise sleep until the wait times out before it notices
+    condition.notify_all();
     thread.join();
 }
 
@@ -80,12 +84,24 @@ Scheduler::~Scheduler()
     }
 }
 
+bool Scheduler::hasQueuedTasks() const
+{
+    // The monitor hands tasks out from its own thread, the queue is only stable under the task lock
+    ScopedLock lock(taskLock);
+    return !tasks.empty();
+}
+
+void Scheduler::notifyMonitor()
+{
+    ScopedLock lock(monitorLock);
+    monitorWait.notify_all();
+}
+
 void Scheduler::monitorTasks()
 {
     UniqueLock lock(monitorLock);
     while(active)
     {
-        monitorWait.wait_for(lock, CONDITIONAL_WAIT_TIMEOUT);
         size_t jobs = 0;
         for (int ii = util::lastIndex(activeWorkers); ii >= 0; --ii)
         {
@@ -120,5 +136,8 @@ void Scheduler::monitorTasks()
         }
 
         totalJobCount = jobs;
+
+        // Look before the first wait as well, tasks may have been scheduled before this thread got started
+        monitorWait.wait_for(lock, CONDITIONAL_WAIT_TIMEOUT);
     }
 }
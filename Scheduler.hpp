@@ -1,6 +1,7 @@
 #pragma once
 
 #include <vector>
+#include <atomic>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
@@ -43,13 +44,15 @@ class Scheduler
         const Input* input;
         size_t size;
         const Context& context;
+        std::atomic<int>* pendingTasks;
 
     public:
-        TaskImpl(const Input* input, size_t size, const Context& context)
+        TaskImpl(const Input* input, size_t size, const Context& context, std::atomic<int>* pendingTasks)
         : idx(0)
         , input(input)
         , size(size)
         , context(context)
+        , pendingTasks(pendingTasks)
         {}
 
         virtual void processNext()
@@ -57,6 +60,7 @@ class Scheduler
             ASSERT(!finished());
             context.process(input[idx]);
             ++idx;
+            if (pendingTasks && finished()) { --*pendingTasks; }
         }
 
         virtual bool finished() const { return remaining() <= 0; }
@@ -69,7 +73,7 @@ class Scheduler
     std::vector<Worker*> activeWorkers;
     std::vector<TaskPtr> tasks;
     std::thread thread;
-    std::mutex taskLock;
+    mutable std::mutex taskLock;
     std::mutex monitorLock;
     std::condition_variable monitorWait;
     int totalJobCount;
@@ -78,45 +82,70 @@ class Scheduler
     static void doMonitorTasks(Scheduler* scheduler) { scheduler->monitorTasks(); }
     void monitorTasks();
 
+    template<typename Input, typename Context>
+    void scheduleTasks(const std::vector<Input>& in, const Context& context, size_t batchSize, std::atomic<int>* pendingTasks);
+
 public:
     Scheduler(int numThreads);
     ~Scheduler();
 
+    // Returns once this input is processed, other work on the same scheduler may still be running
     template<typename Input, typename Context>
     void schedule(const std::vector<Input>& in, const Context& context);
 
+    // Splits the input evenly over the workers unless a batch size is given, batches are started from the back
     template<typename Input, typename Context>
-    void scheduleAsync(const std::vector<Input>& in, const Context& context);
+    void scheduleAsync(const std::vector<Input>& in, const Context& context, size_t batchSize = 0);
 
     int getTotalJobCount() const { return totalJobCount; }
+    int getWorkerCount() const { return static_cast<int>(workers.size()); }
     bool isFinished() const { return tasks.empty() && activeWorkers.empty(); }
+    // Every task has been handed to a worker, idle workers would pick up anything scheduled now
+    bool hasQueuedTasks() const;
     void wakeUp() { monitorWait.notify_all(); }
+    // Holds the monitor lock while notifying, so the wake up cannot slip in between the monitor's last look and its wait
+    void notifyMonitor();
 };
 
 template<typename Input, typename Context>
 void Scheduler::schedule(const std::vector<Input>& in, const Context& context)
 {
-    scheduleAsync<Input, Context>(in, context);
+    std::atomic<int> pendingTasks(0);
+    scheduleTasks<Input, Context>(in, context, 0, &pendingTasks);
 
-    while (!isFinished())
+    while (pendingTasks > 0)
     {
         std::this_thread::yield();
     }
 }
 
+template<typename Input, typename Context>
+void Scheduler::scheduleAsync(const std::vector<Input>& in, const Context& context, size_t batchSize)
+{
+    scheduleTasks<Input, Context>(in, context, batchSize, nullptr);
+}
 
 template<typename Input, typename Context>
-void Scheduler::scheduleAsync(const std::vector<Input>& in, const Context& context)
+void Scheduler::scheduleTasks(const std::vector<Input>& in, const Context& context, size_t batchSize, std::atomic<int>* pendingTasks)
 {
-    const auto taskCount = in.size();
-    const auto batchCount = taskCount / workers.size();
+    const size_t taskCount = in.size();
+    const size_t workerCount = workers.size();
+    if (!batchSize)
+    {
+        batchSize = taskCount > workerCount ? (taskCount + workerCount - 1) / workerCount : 1;
+    }
+    if (pendingTasks)
+    {
+        *pendingTasks = static_cast<int>((taskCount + batchSize - 1) / batchSize);
+    }
     {
         ScopedLock lock(taskLock);
-        for (int ii = 0; ii < taskCount; ii += batchCount)
+        for (size_t ii = 0; ii < taskCount; ii += batchSize)
         {
-            tasks.emplace_back(new TaskImpl<Input, Context>(in.data() + ii, batchCount, context));
+            const size_t size = taskCount - ii < batchSize ? taskCount - ii : batchSize;
+            tasks.emplace_back(new TaskImpl<Input, Context>(in.data() + ii, size, context, pendingTasks));
         }
         totalJobCount += taskCount;
     }
-    monitorWait.notify_all();
+    notifyMonitor();
 }
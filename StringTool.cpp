@@ -1,5 +1,7 @@
 #include "StringTool.hpp"
 #include <string>
+#include <cstdlib>
+#include <cstring>
 
 const bool util::StringTool::parseVec3f(const char* str, math::Vec3f* vec)
 {
@@ -53,6 +55,58 @@ const bool util::StringTool::parseInteger(const char* str, int* integer)
     return true;
 }
 
+namespace {
+    static const int MAX_NUMBER_LENGTH = 63;
+
+    // Numbers in views are not zero terminated, copy them to the stack first
+    inline bool terminate(const util::StringView& str, char (&buffer)[MAX_NUMBER_LENGTH + 1])
+    {
+        if (str.empty() || str.size > MAX_NUMBER_LENGTH) { return false; }
+        std::memcpy(buffer, str.data, str.size);
+        buffer[str.size] = 0;
+        return true;
+    }
+}
+
+const bool util::StringTool::parseVec3f(const StringView& str, math::Vec3f* vec)
+{
+    char buffer[MAX_NUMBER_LENGTH + 1];
+    if (!terminate(str, buffer)) { return false; }
+    float axis[3];
+    char* next = buffer;
+    for (int ii = 0; ii < 3; ++ii)
+    {
+        char* end = nullptr;
+        axis[ii] = std::strtof(next, &end);
+        if (end == next) { return false; }
+        next = end;
+    }
+    *vec = {axis[0], axis[1], axis[2]};
+    return true;
+}
+
+const bool util::StringTool::parseFloat(const StringView& str, float* number)
+{
+    char buffer[MAX_NUMBER_LENGTH + 1];
+    if (!terminate(str, buffer)) { return false; }
+    char* end = nullptr;
+    const float value = std::strtof(buffer, &end);
+    if (end == buffer) { return false; }
+    *number = value;
+    return true;
+}
+
+const bool util::StringTool::parseInteger(const StringView& str, int* integer)
+{
+    char buffer[MAX_NUMBER_LENGTH + 1];
+    if (!terminate(str, buffer)) { return false; }
+    char* end = nullptr;
+    const long value = std::strtol(buffer, &end, 10);
+    if (end == buffer) { return false; }
+    *integer = static_cast<int>(value);
+    return true;
+}
+
 void util::StringTool::append(std::vector<char>* buffer, const char* start, const char* end)
 {
     auto size = end - start;
@@ -89,12 +143,14 @@ void util::StringTool::appendWrapped(std::vector<char>* buffer, const std::strin
             continue;
         }
 
-        if (length == maxWidth)
+        // The width can be reached on a space, which skips the check above, so cut as soon as it is exceeded
+        if (length >= maxWidth && wordLength)
         {
             append(buffer, lastCut, lastCut + wordLength);
             append(buffer, separator);
             length = length - wordLength;
             lastCut += wordLength;
+            wordLength = 0;
         }
     }
 
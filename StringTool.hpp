@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Math.hpp"
+#include "StringView.hpp"
 #include <vector>
 #include <string>
 
@@ -12,6 +13,9 @@ struct StringTool
     static const bool parseVec3f(const char* str, math::Vec3f* vec);
     static const bool parseFloat(const char* str, float* number);
     static const bool parseInteger(const char* str, int* integer);
+    static const bool parseVec3f(const StringView& str, math::Vec3f* vec);
+    static const bool parseFloat(const StringView& str, float* number);
+    static const bool parseInteger(const StringView& str, int* integer);
     static void append(std::vector<char>* buffer, const char* start, const char* end);
     static void append(std::vector<char>* buffer, const char* text);
     static void append(std::vector<char>* buffer, const std::string& text);
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace util
+{
+    // FNV-1a, usable in constant expressions so known strings can be switch labels
+    constexpr std::uint32_t hashString(const char* str, std::uint32_t hash = 2166136261u)
+    {
+        return *str ? hashString(str + 1, (hash ^ static_cast<std::uint8_t>(*str)) * 16777619u) : hash;
+    }
+
+    // Non-owning reference to a range of characters, not necessarily zero terminated
+    struct StringView
+    {
+        const char* data;
+        int size;
+
+        StringView() : data(nullptr), size(0) {}
+        StringView(const char* data, int size) : data(data), size(size) {}
+
+        bool empty() const { return size == 0; }
+        bool startsWith(const char* prefix) const;
+        std::uint32_t hash() const;
+        const std::string toString() const { return std::string(data, size); }
+
+        bool operator==(const char* str) const { return std::strlen(str) == static_cast<std::size_t>(size) && std::memcmp(data, str, size) == 0; }
+        bool operator!=(const char* str) const { return !(*this == str); }
+    };
+
+    inline bool StringView::startsWith(const char* prefix) const
+    {
+        const int length = static_cast<int>(std::strlen(prefix));
+        return length <= size && std::strncmp(data, prefix, length) == 0;
+    }
+
+    inline std::uint32_t StringView::hash() const
+    {
+        std::uint32_t hash = 2166136261u;
+        for (int ii = 0; ii < size; ++ii)
+        {
+            hash = (hash ^ static_cast<std::uint8_t>(data[ii])) * 16777619u;
+        }
+        return hash;
+    }
+}
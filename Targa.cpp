@@ -3,6 +3,7 @@
 #include "BinaryWriter.hpp"
 #include "Assert.hpp"
 #include <string>
+#include <cstring>
 
 // Reference: http://paulbourke.net/dataformats/tga/
 namespace {
@@ -43,12 +44,27 @@ namespace {
     };
 
     static_assert(sizeof(ImageDescriptor) == 1, "ImageDescriptor fits in a single byte");
+
+    static const int PIXEL_SIZE = 4;
+    static const int MAX_PACKET_LENGTH = 128;
+    static const std::uint8_t RLE_PACKET_FLAG = 0x80;
+
+    static const Image::Channel CHANNEL_ORDER[] = {
+        Image::BLUE,
+        Image::GREEN,
+        Image::RED,
+        Image::ALPHA,
+    };
+
+    inline bool isSamePixel(const std::uint8_t* pixels, int a, int b)
+    {
+        return !std::memcmp(pixels + a * PIXEL_SIZE, pixels + b * PIXEL_SIZE, PIXEL_SIZE);
+    }
 }
 
-const targa::Buffer targa::encode(const Image& image, const char* identifier)
+void targa::encodeHeader(const Image& image, const char* identifier, Compression compression, Buffer* output)
 {
     static const std::size_t MAX_ID_LENGTH = 256;
-    static const int datatype = DATATYPE_RGB;
     static const ImageDescriptor descriptor;
 
     std::string identifierStr = identifier;
@@ -57,8 +73,10 @@ const targa::Buffer targa::encode(const Image& image, const char* identifier)
         identifierStr.erase(MAX_ID_LENGTH);
     }
     ASSERT(image.format == Image::FORMAT_ARGB); // Only ARGB is supported
+    const int datatype = compression == COMPRESSION_RLE ? DATATYPE_RGB_RLE : DATATYPE_RGB;
 
     util::BinaryWriter writer;
+    writer.stream.swap(*output);
     writer.write<std::uint8_t>(identifierStr.size()); // idlength
     writer.write<std::uint8_t>(0); // colourmaptype
     writer.write<std::uint8_t>(datatype); // datatypecode
@@ -72,25 +90,101 @@ const targa::Buffer targa::encode(const Image& image, const char* identifier)
     writer.write<std::uint8_t>(image.getPixelSize() << 3); // bitsperpixel
     writer.write(descriptor); // imagedescriptor
     writer.write(identifierStr);
+    writer.stream.swap(*output);
+}
 
-    static const Image::Channel CHANNEL_ORDER[] = {
-        Image::BLUE,
-        Image::GREEN,
-        Image::RED,
-        Image::ALPHA,
-    };
-    static const int CHANNEL_COUNT = 4; // TODO: Deduce from actual array
-    for (int row = image.height - 1; row >= 0; --row)
+void targa::encodeRow(const Image& image, int row, Compression compression, Buffer* output)
+{
+    ASSERT(0 <= row && row < image.height);
+    ASSERT(image.getPixelSize() == PIXEL_SIZE);
+
+    // The ARGB layout in memory usually is BGRA already, only shuffle channels when it is not
+    const std::uint8_t* pixels = image.pixels.data() + row * image.width * PIXEL_SIZE;
+    std::vector<std::uint8_t> converted;
+    bool fileOrder = true;
+    for (int ii = 0; ii < PIXEL_SIZE; ++ii)
+    {
+        fileOrder = fileOrder && image.getChannelOffset(CHANNEL_ORDER[ii]) == ii;
+    }
+    if (!fileOrder)
     {
-        for (int col = 0; col < image.width; ++col)
+        converted.resize(image.width * PIXEL_SIZE);
+        for (int ii = 0; ii < PIXEL_SIZE; ++ii)
         {
-            int pixelIdx = (col + row * image.width) * image.getPixelSize();
-            for (int channelIdx = 0; channelIdx < CHANNEL_COUNT; ++channelIdx)
+            const int offset = image.getChannelOffset(CHANNEL_ORDER[ii]);
+            for (int col = image.width - 1; col >= 0; --col)
             {
-                const int offset = image.getChannelOffset(CHANNEL_ORDER[channelIdx]);
-                writer.write<std::uint8_t>(image.pixels[pixelIdx + offset]);
+                converted[col * PIXEL_SIZE + ii] = pixels[col * PIXEL_SIZE + offset];
             }
         }
+        pixels = converted.data();
+    }
+
+    if (compression == COMPRESSION_NONE)
+    {
+        output->insert(output->end(), pixels, pixels + image.width * PIXEL_SIZE);
+        return;
     }
-    return writer.stream;
+
+    // Packets never cross rows, so rows can be encoded independently
+    for (int col = 0; col < image.width;)
+    {
+        int runLength = 1;
+        while (col + runLength < image.width && runLength < MAX_PACKET_LENGTH && isSamePixel(pixels, col, col + runLength))
+        {
+            ++runLength;
+        }
+
+        if (runLength > 1)
+        {
+            output->push_back(static_cast<std::uint8_t>(RLE_PACKET_FLAG | (runLength - 1)));
+            output->insert(output->end(), pixels + col * PIXEL_SIZE, pixels + (col + 1) * PIXEL_SIZE);
+            col += runLength;
+            continue;
+        }
+
+        // Raw packets stop where the next run starts
+        int rawLength = 1;
+        while (col + rawLength < image.width && rawLength < MAX_PACKET_LENGTH
+               && !(col + rawLength + 1 < image.width && isSamePixel(pixels, col + rawLength, col + rawLength + 1)))
+        {
+            ++rawLength;
+        }
+        output->push_back(static_cast<std::uint8_t>(rawLength - 1));
+        output->insert(output->end(), pixels + col * PIXEL_SIZE, pixels + (col + rawLength) * PIXEL_SIZE);
+        col += rawLength;
+    }
+}
+
+const targa::Buffer targa::encode(const Image& image, const char* identifier, Compression compression)
+{
+    Buffer buffer;
+    encodeHeader(image, identifier, compression, &buffer);
+    buffer.reserve(buffer.size() + image.pixels.size());
+    for (int row = image.height - 1; row >= 0; --row)
+    {
+        encodeRow(image, row, compression, &buffer);
+    }
+    return buffer;
+}
+
+targa::FileWriter::FileWriter(File&& file, const Image& image, const char* identifier, Compression compression)
+: file(std::move(file))
+, image(image)
+, compression(compression)
+, nextRow(image.height - 1)
+, failed(false)
+{
+    if (this->file.isValid())
+    {
+        encodeHeader(image, identifier, compression, &buffer);
+        flush();
+    }
+}
+
+void targa::FileWriter::flush()
+{
+    if (buffer.empty() || !isValid()) { return; }
+    failed = file.write(buffer.data(), buffer.size()) != 1;
+    buffer.clear();
 }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "File.hpp"
 #include <vector>
 #include <cstdint>
 
@@ -8,5 +9,52 @@ struct Image;
 namespace targa
 {
     typedef std::vector<std::uint8_t> Buffer;
-    const Buffer encode(const Image& image, const char* identifier = "");
+
+    enum Compression
+    {
+        COMPRESSION_NONE,
+        COMPRESSION_RLE, // Run-length encoded per row, large flat areas shrink to a few bytes
+    };
+
+    const Buffer encode(const Image& image, const char* identifier = "", Compression compression = COMPRESSION_NONE);
+
+    // Building blocks for incremental encoding, a file is the header followed by every row from the bottom up
+    void encodeHeader(const Image& image, const char* identifier, Compression compression, Buffer* output);
+    void encodeRow(const Image& image, int row, Compression compression, Buffer* output);
+
+    // Streams an image to disk while it is being drawn, rows are written in file order once they are finished
+    class FileWriter
+    {
+        File file;
+        const Image& image;
+        Compression compression;
+        int nextRow;
+        bool failed;
+        Buffer buffer;
+
+    public:
+        FileWriter(File&& file, const Image& image, const char* identifier, Compression compression);
+
+        bool isValid() const { return file.isValid() && !failed; }
+        bool isComplete() const { return nextRow < 0; }
+
+        // Writes every row up to the first one that is not finished yet
+        template<typename IsRowFinished>
+        void writeFinishedRows(const IsRowFinished& isRowFinished);
+        void writeRemainingRows() { writeFinishedRows([](int) { return true; }); }
+
+    private:
+        void flush();
+    };
 };
+
+template<typename IsRowFinished>
+void targa::FileWriter::writeFinishedRows(const IsRowFinished& isRowFinished)
+{
+    while (!isComplete() && isRowFinished(nextRow))
+    {
+        encodeRow(image, nextRow, compression, &buffer);
+        --nextRow;
+    }
+    flush();
+}
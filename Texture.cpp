@@ -1,5 +1,7 @@
 #include "Texture.hpp"
+#include "Assert.hpp"
 #include <cstdint>
+#include <algorithm>
 
 Texture Texture::createFromIndexedRGB(int width, int height, const void *indices, const void *palette)
 {
@@ -71,3 +73,94 @@ const Color Texture::sample(int x, int y) const
     const float b = byte_b / 255.0f;
     return Color(r, g, b);
 }
+
+const Palette Palette::createFromRGB(const void* rgb)
+{
+    auto bytes = reinterpret_cast<const std::uint8_t*>(rgb);
+    Palette palette;
+    for (int ii = SIZE - 1; ii >= 0; --ii)
+    {
+        palette.colors[ii] = Color(bytes[ii * 3 + 0] / 255.0f, bytes[ii * 3 + 1] / 255.0f, bytes[ii * 3 + 2] / 255.0f);
+    }
+    return palette;
+}
+
+namespace {
+    inline int calcWrapMask(int size)
+    {
+        return (size & (size - 1)) == 0 ? size - 1 : 0;
+    }
+}
+
+IndexedTexture::IndexedTexture(int width, int height, int levelCount)
+    : levelCount(levelCount)
+{
+    ASSERT(0 < levelCount && levelCount <= calcLevelCount(width, height));
+    int offset = 0;
+    for (int ii = 0; ii < levelCount; ++ii)
+    {
+        Level& level = levels[ii];
+        level.width = width >> ii;
+        level.height = height >> ii;
+        level.widthMask = calcWrapMask(level.width);
+        level.heightMask = calcWrapMask(level.height);
+        level.offset = offset;
+        level.scale = 1.0f / (1 << ii);
+        offset += level.width * level.height;
+    }
+    indices.resize(offset);
+}
+
+int IndexedTexture::calcLevelCount(int width, int height)
+{
+    int count = 1;
+    while (count < MAX_LEVELS && (width >> count) > 0 && (height >> count) > 0)
+    {
+        ++count;
+    }
+    return count;
+}
+
+IndexedTexture IndexedTexture::createFromMips(int width, int height, const void* const* mips, int levelCount)
+{
+    IndexedTexture texture(width, height, levelCount);
+    for (int ii = 0; ii < levelCount; ++ii)
+    {
+        const Level& level = texture.levels[ii];
+        auto bytes = reinterpret_cast<const std::uint8_t*>(mips[ii]);
+        std::copy(bytes, bytes + level.width * level.height, texture.indices.begin() + level.offset);
+    }
+    return texture;
+}
+
+IndexedTexture IndexedTexture::createCheckerBoard(int width, int height, int checkerSize, std::uint8_t a, std::uint8_t b)
+{
+    IndexedTexture texture(width, height, calcLevelCount(width, height));
+    int cellX = 0;
+    int cellY = 0;
+    for (int x = 0; x < width; ++x)
+    {
+        cellY = 0;
+        for (int y = 0; y < height; ++y)
+        {
+            texture.indices[x + y * width] = (cellX & 1) ^ (cellY & 1) ? a : b;
+            if (y % checkerSize == 0) { cellY += 1; }
+        }
+        if (x % checkerSize == 0) { cellX += 1; }
+    }
+
+    // Smaller levels pick every other texel of the level above
+    for (int ii = 1; ii < texture.levelCount; ++ii)
+    {
+        const Level& level = texture.levels[ii];
+        const Level& parent = texture.levels[ii - 1];
+        for (int y = level.height - 1; y >= 0; --y)
+        {
+            for (int x = level.width - 1; x >= 0; --x)
+            {
+                texture.indices[level.offset + x + y * level.width] = texture.indices[parent.offset + x * 2 + y * 2 * parent.width];
+            }
+        }
+    }
+    return texture;
+}
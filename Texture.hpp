@@ -3,6 +3,7 @@
 #include <vector>
 #include <cstdint>
 #include "Color.hpp"
+#include <cmath>
 
 class Texture
 {
@@ -27,3 +28,83 @@ private:
     int channels;
     std::vector<std::uint8_t> pixels;
 };
+
+// 256 colors converted to float once, so sampling an indexed texture is a single table lookup
+struct Palette
+{
+    static const int SIZE = 256;
+    static const int FIRST_FULLBRIGHT = 224;
+
+    static const Palette createFromRGB(const void* rgb);
+    static bool isFullbright(int index) { return index >= FIRST_FULLBRIGHT; }
+
+    Color colors[SIZE];
+};
+
+// Texture kept as the original 8-bit palette indices, together with its smaller mip levels
+class IndexedTexture
+{
+public:
+    static const int MAX_LEVELS = 4;
+
+    // mips holds the indices of every level, each level half the size of the one before
+    static IndexedTexture createFromMips(int width, int height, const void* const* mips, int levelCount);
+    static IndexedTexture createCheckerBoard(int width, int height, int checkerSize, std::uint8_t a, std::uint8_t b);
+    static int calcLevelCount(int width, int height);
+
+    int getWidth() const { return levels[0].width; }
+    int getHeight() const { return levels[0].height; }
+    int getLevelCount() const { return levelCount; }
+    const std::vector<std::uint8_t>& getIndices() const { return indices; } // All levels, largest first
+
+    std::uint8_t getIndex(int x, int y) const { return indices[x + y * levels[0].width]; }
+    // Texture coordinates are given in texels of the largest level, rounded to the nearest texel of the
+    // requested level and wrapped around the texture edges
+    std::uint8_t sample(float u, float v, int level = 0) const;
+    // Level whose texels best match the area a sample covers, footprint is measured in texels of the largest level
+    int selectLevel(float footprint) const;
+
+private:
+    IndexedTexture(int width, int height, int levelCount);
+
+    static int wrap(float coord, int size, int mask)
+    {
+        const int texel = static_cast<int>(std::floor(coord + 0.5f));
+        if (mask) { return texel & mask; }
+        const int wrapped = texel % size;
+        return wrapped < 0 ? wrapped + size : wrapped;
+    }
+
+    struct Level
+    {
+        int width;
+        int height;
+        int widthMask;  // size - 1 for power of two sizes, 0 otherwise
+        int heightMask;
+        int offset;     // Start of this level in indices
+        float scale;    // Texels of this level per texel of the largest level
+    };
+
+    Level levels[MAX_LEVELS];
+    int levelCount;
+    std::vector<std::uint8_t> indices;
+};
+
+inline std::uint8_t IndexedTexture::sample(float u, float v, int level) const
+{
+    const Level& mip = levels[level];
+    const int x = wrap(u * mip.scale, mip.width, mip.widthMask);
+    const int y = wrap(v * mip.scale, mip.height, mip.heightMask);
+    return indices[mip.offset + x + y * mip.width];
+}
+
+inline int IndexedTexture::selectLevel(float footprint) const
+{
+    int level = 0;
+    while (footprint >= 2.0f && level < levelCount - 1)
+    {
+        footprint *= 0.5f;
+        ++level;
+    }
+    return level;
+}